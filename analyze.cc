@@ -22,20 +22,25 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "dedup.h"
+#include "logread.h"
+#include "profile.h"
+#include "render.h"
+
 const char* weekDay[7] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
 
 
 unsigned int  gDebug = 0;
 bool          gSpeed = false;
 FILE         *gDaily = NULL;
+char         *gDailyData = NULL;
+size_t        gDailyLen  = 0;
 FILE         *gPlot  = NULL;
+bool          gRender = false;
 unsigned int  gXCount = 0;
-typedef struct event_s {
-  time_t stamp;
-  double speed;
-  bool   isUp;
-} event_t;
-
+dedupConfig_t gDedup = {10, 3, 5.0, false};
+const char   *gProfile = NULL;
+double        gZMax    = 3.0;
 time_t gStartOfDay;
 
 
@@ -53,9 +58,10 @@ bins_t dailyCount[24 * 4];
 
 struct speedBins_s {
   struct avg_s {
-    double min;
-    double sum;
-    double max;
+    double       min;
+    double       sum;
+    double       max;
+    unsigned int n;
   } up;
   struct avg_s dn;
 } speeds, speedsByInterval[24*4];
@@ -64,6 +70,7 @@ void
 recordSpeed(struct speedBins_s::avg_s &bin, event_t ev)
 {  
   bin.sum += ev.speed;
+  bin.n++;
   if (bin.min == 0 || bin.min > ev.speed) bin.min = ev.speed;
   if (bin.max < ev.speed) bin.max = ev.speed;
 }
@@ -73,6 +80,8 @@ analyzeEvent(event_t ev)
 {
   // Gather metrics in 15mins intervals
   unsigned int interval = (ev.stamp - gStartOfDay) / (15 * 60);
+  if (interval >= 24*4) return false;
+
   if (ev.isUp) {
     dailyCount[interval].up++;
     // A speed below 5 MPH or above 30 MPH is probably bogus
@@ -158,34 +167,54 @@ reportDay()
 bool
 gnuplotDay(FILE *fp, const char *date, const char *wday)
 {
-  char fname[64];
-  sprintf(fname, "data.%s.dat", date);
-  FILE *data = fopen(fname, "w");
+  // The day's data is streamed inline as a gnuplot datablock rather than
+  // through a temporary file, and is sent with a single write
+  char   *data    = NULL;
+  size_t  dataLen = 0;
+  FILE   *dfp     = open_memstream(&data, &dataLen);
+  if (dfp == NULL) {
+    fprintf(stderr, "ERROR: Cannot allocate plot data: %s\n", strerror(errno));
+    return false;
+  }
+  fprintf(dfp, "$day << EOD\n");
+
   int j = 0;
   bins_t total;
+  renderBin_t bins[16*4];
   for (int i = 0; i < 24*4; i++) {
     // Only plot from 6:00 to 22:00
     if (6*4 <= i && i < 22*4) {
       if (gSpeed) {
 	if (dailyCount[i].up > 0) {
-	  fprintf(data, "%d %02d:%02d %f %f %f", j, 6 + (j/4),  15 * (j % 4),
+	  fprintf(dfp, "%d %02d:%02d %f %f %f", j, 6 + (j/4),  15 * (j % 4),
 		  speedsByInterval[i].up.min, speedsByInterval[i].up.sum / dailyCount[i].up, speedsByInterval[i].up.max);
 	} else {
-	  fprintf(data, "%d %02d:%02d nan nan nan", j, 6 + (j/4),  15 * (j % 4));
+	  fprintf(dfp, "%d %02d:%02d nan nan nan", j, 6 + (j/4),  15 * (j % 4));
 	}
 	if (dailyCount[i].dn > 0) {
-	  fprintf(data, " %f %f %f",
+	  fprintf(dfp, " %f %f %f",
 		  speedsByInterval[i].dn.min, speedsByInterval[i].dn.sum / dailyCount[i].dn, speedsByInterval[i].dn.max);
 	} else {
-	  fprintf(data, " nan nan nan");
+	  fprintf(dfp, " nan nan nan");
 	}
       } else {
-	fprintf(data, "%02d:%02d %d -%d", 6 + (j/4),  15 * (j % 4), dailyCount[i].up, dailyCount[i].dn);
+	fprintf(dfp, "%02d:%02d %d -%d", 6 + (j/4),  15 * (j % 4), dailyCount[i].up, dailyCount[i].dn);
       }
 
       // To print xtick every hour
-      if (j%4 == 0) fprintf(data, " 0");
-      fprintf(data, "\n");
+      if (j%4 == 0) fprintf(dfp, " 0");
+      fprintf(dfp, "\n");
+
+      if (gRender) {
+	bins[j].up    = dailyCount[i].up;
+	bins[j].dn    = dailyCount[i].dn;
+	bins[j].upMin = speedsByInterval[i].up.min;
+	bins[j].upAve = (dailyCount[i].up > 0) ? speedsByInterval[i].up.sum / dailyCount[i].up : 0;
+	bins[j].upMax = speedsByInterval[i].up.max;
+	bins[j].dnMin = speedsByInterval[i].dn.min;
+	bins[j].dnAve = (dailyCount[i].dn > 0) ? speedsByInterval[i].dn.sum / dailyCount[i].dn : 0;
+	bins[j].dnMax = speedsByInterval[i].dn.max;
+      }
       j++;
     }
 
@@ -193,10 +222,21 @@ gnuplotDay(FILE *fp, const char *date, const char *wday)
     total.dn += dailyCount[i].dn;
   }
 
-  fclose(data);
+  fprintf(dfp, "EOD\n");
+  fclose(dfp);
 
-  // Skip empty files
-  if (total.up + total.dn < 20) return false;
+  // Skip empty days
+  if (total.up + total.dn < 20) {
+    free(data);
+    return false;
+  }
+
+  if (gRender) {
+    renderBin_t sum = {total.up, total.dn,
+		       speeds.up.min, (total.up > 0) ? speeds.up.sum / total.up : 0, speeds.up.max,
+		       speeds.dn.min, (total.dn > 0) ? speeds.dn.sum / total.dn : 0, speeds.dn.max};
+    renderDay(date, wday, bins, j, sum);
+  }
 
   if (gSpeed) {
 
@@ -218,8 +258,9 @@ gnuplotDay(FILE *fp, const char *date, const char *wday)
       if (gXCount%7 == 0) fprintf(gDaily, " 0");
       fprintf(gDaily, "\n");
 
-    } else {
+    } else if (fp != NULL) {
 
+      fwrite(data, 1, dataLen, fp);
       fprintf(fp, "set title '%s %s' offset 0,-15\n", wday, date);
       fprintf(fp, "set key bottom right\n");
       fprintf(fp, "set datafile separator \" \"\n");
@@ -227,7 +268,7 @@ gnuplotDay(FILE *fp, const char *date, const char *wday)
       fprintf(fp, "set grid ytics\n");
       fprintf(fp, "set yrange [0:30]\n");
       fprintf(fp, "set ytics (0,5, 10, 15, 20, 25, 30)\n");
-      fprintf(fp, "plot '%s' using 9:xtic(2) notitle, '' using 1:4:3:5:4 notitle with candlesticks whiskerbars lw 3 lc 2, '' using 1:7:6:8:7 notitle with candlesticks whiskerbars lw 3 lc 3, '' using 1:4 title 'Uphill %.1f/%.1f MPH Ave/Max Speed' with points pointtype 5 lc 2 ps 1.8, '' using 1:7 title 'Downhill %.1f/%.1f MPH Ave/Max Speed' with points pointtype 5 lc 3 ps 1.8\n", fname, speeds.up.sum / total.up, speeds.up.max, speeds.dn.sum / total.dn, speeds.dn.max);
+      fprintf(fp, "plot $day using 9:xtic(2) notitle, '' using 1:4:3:5:4 notitle with candlesticks whiskerbars lw 3 lc 2, '' using 1:7:6:8:7 notitle with candlesticks whiskerbars lw 3 lc 3, '' using 1:4 title 'Uphill %.1f/%.1f MPH Ave/Max Speed' with points pointtype 5 lc 2 ps 1.8, '' using 1:7 title 'Downhill %.1f/%.1f MPH Ave/Max Speed' with points pointtype 5 lc 3 ps 1.8\n", speeds.up.sum / total.up, speeds.up.max, speeds.dn.sum / total.dn, speeds.dn.max);
     }
 
   } else {
@@ -239,8 +280,9 @@ gnuplotDay(FILE *fp, const char *date, const char *wday)
       if (gXCount%7 == 0) fprintf(gDaily, " 0");
       fprintf(gDaily, "\n");
 
-    } else {
+    } else if (fp != NULL) {
 
+      fwrite(data, 1, dataLen, fp);
       fprintf(fp, "set title '%s %s' offset 0,-7\n", wday, date);
       fprintf(fp, "set key center right\n");
       fprintf(fp, "set style data histograms\n");
@@ -251,20 +293,42 @@ gnuplotDay(FILE *fp, const char *date, const char *wday)
       fprintf(fp, "set datafile separator \" \"\n");
       fprintf(fp, "set xtics auto\n");
       fprintf(fp, "set ytics (-20,0,20,40,60)\n");
-      fprintf(fp, "plot '%s' using 4:xtic(1) notitle, '' using 2 title '%d   Uphill', '' using 3 title '%d Downhill'\n", fname, total.up, total.dn);
+      fprintf(fp, "plot $day using 4:xtic(1) notitle, '' using 2 title '%d   Uphill', '' using 3 title '%d Downhill'\n", total.up, total.dn);
     }
 
   }
   gXCount++;
+  free(data);
 
   return true;
 }
 
 
+//
+// Parse a line from the CarCounter log:
+// "1520143303  2018/03/04 06:01:43    9.4 MPH   Uphill. ..."
+//
+event_t
+parseEvent(const char *line)
+{
+  event_t ev = {atol(line), atof(line+34), line[45] == 'U', 0, 0};
+
+  // Loggers with more than one pair of hoses tag the lane
+  const char *lane = strstr(line, "Lane=");
+  if (lane != NULL) ev.lane = atoi(lane + 5);
+
+  // The CarCounter groups the axles of each vehicle
+  const char *axles = strstr(line, "Axles=");
+  if (axles != NULL) ev.nAxles = atoi(axles + 6);
+
+  return ev;
+}
+
+
 bool
 analyzeFile(const char* fname)
 {
-  FILE *fp = fopen(fname, "r");
+  FILE *fp = logOpen(fname);
   if (fp == NULL) {
     fprintf(stderr, "ERROR: Cannot open \"%s\" for reading: %s\n", fname, strerror(errno));
     return false;
@@ -277,60 +341,72 @@ analyzeFile(const char* fname)
   char *line = NULL;
   size_t lineLen = 0;
 
-  event_t prevEv = {0, 0, false};
-
   ssize_t len;
   len = getline(&line, &lineLen, fp);
-  if (len < 0) return false;
-  prevEv = {atol(line), atof(line+34), line[45] == 'U'};
+  if (len < 0) {
+    if (ferror(fp)) fprintf(stderr, "ERROR: Cannot read \"%s\"\n", fname);
+    else fprintf(stderr, "ERROR: \"%s\" is empty\n", fname);
+    free(line);
+    fclose(fp);
+    return false;
+  }
+  event_t ev = parseEvent(line);
 
-  struct tm *lt = localtime(&prevEv.stamp);
+  struct tm *lt = localtime(&ev.stamp);
   lt->tm_hour = 0;
   lt->tm_min  = 0;
   lt->tm_sec  = 0;
   gStartOfDay = mktime(lt);
+  unsigned int wdayNum = lt->tm_wday;
+  const char *wday = weekDay[wdayNum];
 
-  printf("%s %s\n", fname+13, weekDay[lt->tm_wday]);
+  // The date, without the ".gz" or ".zst" of a compressed log
+  char date[32];
+  snprintf(date, sizeof(date), "%s", fname+13);
+  char *ext = strchr(date, '.');
+  if (ext != NULL) *ext = '\0';
 
-  if (gDebug > 1) fputs(line, stdout);
-    
-  while ((len = getline(&line, &lineLen, fp)) > 0) {
+  printf("%s %s\n", date, wday);
 
-    event_t ev = {atol(line), atof(line+34), line[45] == 'U'};
+  dedupBegin();
+  do {
+    if (gDebug > 1) fputs(line, stdout);
 
-    // Two events, seperated by 3 sec or less are the same car
-    if ((prevEv.stamp <= ev.stamp && ev.stamp <= prevEv.stamp+3)
-	&& prevEv.isUp == ev.isUp) {
-      // If the two speeds are too far apart, there's been a glitch
-      double diff = ev.speed - prevEv.speed;
-      if (-5.0 < diff && diff < 5.0) {
-	// Average the speed
-	ev.speed = (ev.speed + prevEv.speed) / 2;
-	ev.stamp = prevEv.stamp;
-      } else {
-	// Ignore the speed
-	ev.speed = 0.0;
-      }
+    dedupEvent(parseEvent(line));
+  } while ((len = getline(&line, &lineLen, fp)) > 0);
 
-      if (gDebug > 1) fputs(line, stdout);
-
-      analyzeEvent(ev);
-      prevEv.stamp = 0;
-    } else {
-      if (prevEv.stamp > 0) analyzeEvent(prevEv);
-      prevEv = ev;
+  if (ferror(fp)) {
+    fprintf(stderr, "ERROR: Cannot read \"%s\"\n", fname);
+    free(line);
+    fclose(fp);
+    return false;
+  }
 
-      if (gDebug > 1) fputs(line, stdout);
-    }
+  // Don't forget the last events of the day!
+  dedupFlush();
 
+  if (gDebug > 0) {
+    const dedupStats_t &stats = dedupStats();
+    printf("Events: %lu, %lu merged (%lu with mismatched speeds), %lu out of order, %lu dropped\n",
+	   stats.events, stats.merged, stats.mismatched, stats.outOfOrder, stats.dropped);
+    if (stats.badLane > 0) printf("Events: %lu in a lane above %d, dropped\n", stats.badLane, DEDUP_MAX_LANES - 1);
   }
 
-  // Don't forget the last event of the day!
-  if (prevEv.stamp > 0) analyzeEvent(prevEv);
-
   reportDay();
-  if (gPlot != NULL) gnuplotDay(gPlot, fname+13, weekDay[lt->tm_wday]);
+
+  if (gProfile != NULL) {
+    profileDay_t day;
+    for (unsigned int i = 0; i < 24*4; i++) {
+      day.up[i] = dailyCount[i].up;
+      day.dn[i] = dailyCount[i].dn;
+      unsigned int n = speedsByInterval[i].up.n + speedsByInterval[i].dn.n;
+      day.speed[i] = (n > 0) ? (speedsByInterval[i].up.sum + speedsByInterval[i].dn.sum) / n : 0;
+    }
+    profileDay(wdayNum, gStartOfDay, day, gZMax);
+  }
+  if (gPlot != NULL || gRender) gnuplotDay(gPlot, date, wday);
   
+  free(line);
   fclose(fp);
 
   return true;
@@ -340,11 +416,19 @@ analyzeFile(const char* fname)
 void
 usage(const char* cmd)
 {
-  fprintf(stderr, "Usage: %s [-D n] [-PS] {fname}\n", cmd);
+  fprintf(stderr, "Usage: %s [-D n] [-PSdK] [-I fname] [-o n] [-m n] [-M n] [-p fname [-z n]] {fname}\n", cmd);
   fprintf(stderr, "\nOptions:\n");
   fprintf(stderr, "    -P           Plot analysis\n");
+  fprintf(stderr, "    -I fname     Render plot analysis to an SVG image, without using gnuplot\n");
   fprintf(stderr, "    -S           Analyze speed rather than volume\n");
   fprintf(stderr, "    -d           Analyze using daily summaries instead of 15mins intervals\n");
+  fprintf(stderr, "    -o n         Put back in order events up to n secs out of order (default: %ld)\n", gDedup.reorderWin);
+  fprintf(stderr, "    -m n         Merge events seperated by n secs or less (default: %ld)\n", gDedup.mergeWin);
+  fprintf(stderr, "    -M n         Ignore the speed of merged events n MPH or more apart (default: %.0f)\n", gDedup.maxSpeedDiff);
+  fprintf(stderr, "    -K           Keep the speed of the first event instead of ignoring it\n");
+  fprintf(stderr, "    -p fname     Compare with, and update, the day-of-week profiles in fname (e.g. logs/weekday.prof)\n");
+  fprintf(stderr, "    -z n         Report intervals more than n standard deviations from the profile (default: %.1f)\n", gZMax);
+  fprintf(stderr, "\nLog files ending in .gz or .zst are decompressed as they are read.\n");
   exit(-1);
 }
 
@@ -352,8 +436,10 @@ usage(const char* cmd)
 int
 main(int argc, char* argv[])
 {
+  const char *image = NULL;
+
   int optc;
-  while ((optc = getopt(argc, argv, "dD:hPS")) != -1) {
+  while ((optc = getopt(argc, argv, "dD:hI:Km:M:o:p:PSz:")) != -1) {
     switch (optc) {
     case 'D':
       gDebug = atoi(optarg);
@@ -363,6 +449,34 @@ main(int argc, char* argv[])
     case '?':
       usage(argv[0]);
 
+    case 'I':
+      image = optarg;
+      break;
+
+    case 'K':
+      gDedup.keepFirst = true;
+      break;
+
+    case 'm':
+      gDedup.mergeWin = atoi(optarg);
+      break;
+
+    case 'M':
+      gDedup.maxSpeedDiff = atof(optarg);
+      break;
+
+    case 'o':
+      gDedup.reorderWin = atoi(optarg);
+      break;
+
+    case 'p':
+      gProfile = optarg;
+      break;
+
+    case 'z':
+      gZMax = atof(optarg);
+      break;
+
     case 'P':
       gPlot = popen("tee gnuplot.cmd | gnuplot > gnuplot.jpg", "w");
       if (gPlot == NULL) {
@@ -376,17 +490,28 @@ main(int argc, char* argv[])
       break;
 
     case 'd':
-      gDaily = fopen("daily.dat", "w");
+      // Daily summaries are accumulated in memory as a gnuplot datablock
+      gDaily = open_memstream(&gDailyData, &gDailyLen);
       if (gDaily == NULL) {
-	fprintf(stderr, "ERROR: Cannot open daily.dat for writing: %s\n", strerror(errno));
+	fprintf(stderr, "ERROR: Cannot allocate daily summaries: %s\n", strerror(errno));
 	exit(-1);
       }
+      fprintf(gDaily, "$daily << EOD\n");
       break;
     }
   }
 
   if (optind == argc) usage(argv[0]);
 
+  dedupInit(gDedup, analyzeEvent);
+
+  if (gProfile != NULL && !profileLoad(gProfile)) exit(-1);
+
+  if (image != NULL) {
+    if (!renderOpen(image, argc - optind, gSpeed, gDaily != NULL)) exit(-1);
+    gRender = true;
+  }
+
   if (gPlot != NULL) {
     unsigned int nPlots = argc - optind;
 
@@ -419,19 +544,29 @@ main(int argc, char* argv[])
     if (!analyzeFile(argv[optind++])) return -1;
   }
 
+  if (gProfile != NULL && !profileSave(gProfile)) return -1;
+
+  if (gDaily) {
+    fprintf(gDaily, "EOD\n");
+    fclose(gDaily);
+  }
+
+  if (gRender) renderClose();
+
   if (gPlot != NULL) {
     //    fprintf(gPlot, "unset multiplot\n");
     if (gDaily) {
-      fclose(gDaily);
+      fwrite(gDailyData, 1, gDailyLen, gPlot);
       if (gSpeed) {
-	fprintf(gPlot, "plot 'daily.dat' using 9:xtic(2) notitle, '' using 1:4:3:5:4 notitle with candlesticks whiskerbars lw 3 lc 2, '' using 1:7:6:8:7 notitle with candlesticks whiskerbars lw 3 lc 3, '' using 1:4 title 'Uphill' with points pointtype 5 lc 2 ps 1.8, '' using 1:7 title 'Downhill' with points pointtype 5 lc 3 ps 1.8\n");
+	fprintf(gPlot, "plot $daily using 9:xtic(2) notitle, '' using 1:4:3:5:4 notitle with candlesticks whiskerbars lw 3 lc 2, '' using 1:7:6:8:7 notitle with candlesticks whiskerbars lw 3 lc 3, '' using 1:4 title 'Uphill' with points pointtype 5 lc 2 ps 1.8, '' using 1:7 title 'Downhill' with points pointtype 5 lc 3 ps 1.8\n");
       } else {
-	fprintf(gPlot, "plot 'daily.dat' using 5:xtic(2) notitle, '' using 3 title 'Uphill', '' using 4 title 'Downhill'\n");
+	fprintf(gPlot, "plot $daily using 5:xtic(2) notitle, '' using 3 title 'Uphill', '' using 4 title 'Downhill'\n");
       }
     }
     fprintf(gPlot, "pause mouse\n");
     pclose(gPlot);
   }
+  free(gDailyData);
   
   return 0;
 }
@@ -0,0 +1,275 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+//
+// Replay a raw capture through the detector, measuring how fast it runs and,
+// given the list of vehicles that are in the capture, how accurate it is.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "classify.h"
+#include "detector.h"
+
+
+// Detected vehicles must be within that many ms of the expected one
+#define MATCH_TOLERANCE 1000
+
+typedef struct sample_s {
+  uint16_t chan0;
+  uint16_t chan1;
+  uint64_t stamp;
+} sample_t;
+
+typedef struct expected_s {
+  uint64_t     stamp;
+  double       mph;
+  bool         isUp;
+  unsigned int nAxles;
+  bool         isMatched;
+} expected_t;
+
+
+//
+// Growable arrays
+//
+template<typename T>
+struct array_s {
+  T            *data;
+  unsigned int  n;
+  unsigned int  max;
+
+  void push(const T &val)
+  {
+    if (n == max) {
+      max = (max == 0) ? 1024 : max * 2;
+      data = (T *) realloc(data, max * sizeof(T));
+      if (data == NULL) {
+	fprintf(stderr, "ERROR: Cannot allocate memory for %d entries\n", max);
+	exit(-1);
+      }
+    }
+    data[n++] = val;
+  }
+};
+
+static array_s<sample_t>   gSamples  = {NULL, 0, 0};
+static array_s<expected_t> gExpected = {NULL, 0, 0};
+static array_s<vehicle_t>  gDetected = {NULL, 0, 0};
+
+
+static void
+recordVehicle(const vehicle_t &v)
+{
+  gDetected.push(v);
+}
+
+
+static int
+cmpVehicle(const void *a, const void *b)
+{
+  uint64_t sa = ((const vehicle_t *) a)->stamp;
+  uint64_t sb = ((const vehicle_t *) b)->stamp;
+  return (sa < sb) ? -1 : (sa > sb);
+}
+
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static bool
+readCapture(const char *fname, sample_t &init)
+{
+  FILE *fp = fopen(fname, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for reading: %s\n", fname, strerror(errno));
+    return false;
+  }
+
+  unsigned int       chan0;
+  unsigned int       chan1;
+  unsigned long long ms;
+
+  if (fscanf(fp, "%x%x%llx", &chan0, &chan1, &ms) != 3) {
+    fprintf(stderr, "ERROR: \"%s\" is not a raw capture\n", fname);
+    fclose(fp);
+    return false;
+  }
+  init = {(uint16_t) chan0, (uint16_t) chan1, ms};
+
+  while (fscanf(fp, "%x%x%llx", &chan0, &chan1, &ms) == 3) {
+    if (ms < 0x10000000000) ms += 0x16100000000;
+    gSamples.push({(uint16_t) chan0, (uint16_t) chan1, ms});
+  }
+
+  fclose(fp);
+  return true;
+}
+
+
+static bool
+readExpected(const char *fname)
+{
+  FILE *fp = fopen(fname, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for reading: %s\n", fname, strerror(errno));
+    return false;
+  }
+
+  char  *line = NULL;
+  size_t lineLen = 0;
+  while (getline(&line, &lineLen, fp) > 0) {
+    if (line[0] == '#') continue;
+
+    unsigned long long stamp;
+    char               dir[8];
+    double             mph;
+    unsigned int       nAxles;
+    if (sscanf(line, "%llu %7s %lf %u", &stamp, dir, &mph, &nAxles) != 4) continue;
+    gExpected.push({stamp, mph, dir[0] == 'U', nAxles, false});
+  }
+
+  free(line);
+  fclose(fp);
+  return true;
+}
+
+
+void
+usage(const char* cmd)
+{
+  fprintf(stderr, "Usage: %s [-n n] [-s site] capture [expected]\n", cmd);
+  fprintf(stderr, "\nOptions:\n");
+  fprintf(stderr, "    -n n         Replay the capture n times, reporting the fastest (default: 3)\n");
+  fprintf(stderr, "    -s site      Use the detector tuned for that site:\n");
+  detectorList(stderr);
+  exit(-1);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  unsigned int nRuns = 3;
+
+  int optc;
+  while ((optc = getopt(argc, argv, "hn:s:")) != -1) {
+    switch (optc) {
+    case 'n':
+      nRuns = atoi(optarg);
+      if (nRuns == 0) nRuns = 1;
+      break;
+
+    case 's':
+      if (!detectorSelect(optarg)) {
+	fprintf(stderr, "ERROR: Unknown site \"%s\"\n", optarg);
+	usage(argv[0]);
+      }
+      break;
+
+    case 'h':
+    case '?':
+      usage(argv[0]);
+    }
+  }
+
+  if (optind == argc || argc - optind > 2) usage(argv[0]);
+
+  sample_t init;
+  if (!readCapture(argv[optind], init)) return -1;
+  if (optind + 1 < argc && !readExpected(argv[optind + 1])) return -1;
+
+  //
+  // Only the detector is timed, not the parsing of the capture
+  //
+  double best = 0;
+  for (unsigned int run = 0; run < nRuns; run++) {
+    gDetected.n = 0;
+    detectorInit(init.chan0, init.chan1);
+    classifyInit(recordVehicle);
+
+    double start = now();
+    for (unsigned int i = 0; i < gSamples.n; i++) {
+      analyzeSample(gSamples.data[i].chan0, gSamples.data[i].chan1, gSamples.data[i].stamp);
+    }
+    classifyFlush();
+    double elapsed = now() - start;
+
+    if (run == 0 || elapsed < best) best = elapsed;
+  }
+
+  printf("Samples:    %u in %.3f s (%.2f Msamples/sec)\n", gSamples.n, best, gSamples.n / best / 1e6);
+  const detectorStats_t &stats = detectorStats();
+  printf("Stuck:      %llu recoveries on hose 0, %llu on hose 1\n", stats.recoveries[0], stats.recoveries[1]);
+
+  if (gExpected.n == 0) return 0;
+
+  //
+  // Match each expected vehicle with the closest detected vehicle in the same direction
+  //
+  qsort(gDetected.data, gDetected.n, sizeof(vehicle_t), cmpVehicle);
+
+  unsigned int matched = 0;
+  unsigned int axles   = 0;
+  double       speedErr = 0;
+  unsigned int first   = 0;
+  for (unsigned int i = 0; i < gDetected.n; i++) {
+    const vehicle_t &v = gDetected.data[i];
+
+    while (first < gExpected.n && gExpected.data[first].stamp + MATCH_TOLERANCE < v.stamp) first++;
+
+    expected_t *best = NULL;
+    for (unsigned int j = first; j < gExpected.n && gExpected.data[j].stamp <= v.stamp + MATCH_TOLERANCE; j++) {
+      expected_t &e = gExpected.data[j];
+      if (e.isMatched || e.isUp != v.isUp) continue;
+      if (best == NULL || llabs((long long) (e.stamp - v.stamp)) < llabs((long long) (best->stamp - v.stamp))) {
+	best = &e;
+      }
+    }
+    if (best == NULL) continue;
+
+    best->isMatched = true;
+    matched++;
+    if (best->nAxles == v.nAxles) axles++;
+    speedErr += (v.mph > best->mph) ? v.mph - best->mph : best->mph - v.mph;
+  }
+
+  printf("Vehicles:   %u expected, %u detected, %u matched\n", gExpected.n, gDetected.n, matched);
+  printf("Precision:  %.1f%%\n", (gDetected.n > 0) ? 100.0 * matched / gDetected.n : 0.0);
+  printf("Recall:     %.1f%%\n", 100.0 * matched / gExpected.n);
+  if (matched > 0) {
+    printf("Axles:      %.1f%% correct\n", 100.0 * axles / matched);
+    printf("Speed:      %.2f MPH mean absolute error\n", speedErr / matched);
+  }
+
+  free(gSamples.data);
+  free(gExpected.data);
+  free(gDetected.data);
+
+  return 0;
+}
@@ -0,0 +1,284 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "capture.h"
+
+
+// Buffers are aligned, and full buffers written, in multiples of that
+#define CAPTURE_ALIGN 4096
+
+static int             gFd       = -1;
+static bool            gIsDirect = false;
+
+static char           *gBufs[CAPTURE_NBUFS];
+static size_t          gLen[CAPTURE_NBUFS];
+// Full buffers belong to the writer thread until they have been written
+static bool            gIsFull[CAPTURE_NBUFS];
+static bool            gIsClosing = false;
+
+// Buffer being filled by the sampler
+static unsigned int    gFill = 0;
+static size_t          gPos  = 0;
+
+static pthread_t       gWriter;
+static pthread_mutex_t gLock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  gFullCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  gFreeCond = PTHREAD_COND_INITIALIZER;
+
+static captureStats_t  gStats;
+static struct timespec gStart;
+
+#ifdef HAVE_LIBURING
+static struct io_uring gRing;
+static bool            gHasRing = false;
+static off_t           gOffset  = 0;
+#endif
+
+
+static double
+since(const struct timespec &start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+
+//
+// Write a buffer, retrying partial writes
+//
+static void
+writeBuffer(const char *buf, size_t len)
+{
+  // Only whole aligned blocks can be written directly
+  if (gIsDirect && len % CAPTURE_ALIGN != 0) {
+    fcntl(gFd, F_SETFL, fcntl(gFd, F_GETFL) & ~O_DIRECT);
+    gIsDirect = false;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (len > 0) {
+    ssize_t n;
+#ifdef HAVE_LIBURING
+    if (gHasRing) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&gRing);
+      io_uring_prep_write(sqe, gFd, buf, len, gOffset);
+      io_uring_submit(&gRing);
+
+      struct io_uring_cqe *cqe;
+      if (io_uring_wait_cqe(&gRing, &cqe) < 0) {
+	n = -1;
+      } else {
+	n = cqe->res;
+	if (n < 0) errno = -n;
+	io_uring_cqe_seen(&gRing, cqe);
+      }
+      if (n > 0) gOffset += n;
+    } else
+#endif
+    n = write(gFd, buf, len);
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "ERROR: Cannot write raw samples: %s\n", strerror(errno));
+      return;
+    }
+    buf += n;
+    len -= n;
+    gStats.bytes += n;
+  }
+
+  gStats.writes++;
+  uint64_t us = (uint64_t) (since(start) * 1e6);
+  if (us > gStats.worstWrite) gStats.worstWrite = us;
+}
+
+
+static void *
+writer(void *)
+{
+  unsigned int next = 0;
+
+  pthread_mutex_lock(&gLock);
+  while (1) {
+    while (!gIsFull[next] && !gIsClosing) pthread_cond_wait(&gFullCond, &gLock);
+    if (!gIsFull[next]) break;
+
+    pthread_mutex_unlock(&gLock);
+    writeBuffer(gBufs[next], gLen[next]);
+    pthread_mutex_lock(&gLock);
+
+    gIsFull[next] = false;
+    pthread_cond_signal(&gFreeCond);
+    next = (next + 1) % CAPTURE_NBUFS;
+  }
+  pthread_mutex_unlock(&gLock);
+
+  return NULL;
+}
+
+
+//
+// Give the buffer being filled to the writer and move on to the next one
+//
+static void
+handOff()
+{
+  pthread_mutex_lock(&gLock);
+  gLen[gFill]    = gPos;
+  gIsFull[gFill] = true;
+  pthread_cond_signal(&gFullCond);
+
+  gFill = (gFill + 1) % CAPTURE_NBUFS;
+  if (gIsFull[gFill]) {
+    gStats.fullWaits++;
+    while (gIsFull[gFill]) pthread_cond_wait(&gFreeCond, &gLock);
+  }
+  pthread_mutex_unlock(&gLock);
+
+  gPos = 0;
+}
+
+
+bool
+captureOpen(const char *fname)
+{
+  // Not all file systems support direct I/O
+  gFd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+  gIsDirect = (gFd >= 0);
+  if (gFd < 0) gFd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (gFd < 0) {
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for writing: %s\n", fname, strerror(errno));
+    return false;
+  }
+
+  for (unsigned int i = 0; i < CAPTURE_NBUFS; i++) {
+    if (posix_memalign((void **) &gBufs[i], CAPTURE_ALIGN, CAPTURE_BUFSIZE) != 0) {
+      fprintf(stderr, "ERROR: Cannot allocate capture buffers\n");
+      return false;
+    }
+    // Fault the pages in now rather than while sampling
+    memset(gBufs[i], 0, CAPTURE_BUFSIZE);
+    gIsFull[i] = false;
+  }
+  gFill = 0;
+  gPos  = 0;
+  gIsClosing = false;
+  memset(&gStats, 0, sizeof(gStats));
+
+#ifdef HAVE_LIBURING
+  gHasRing = (io_uring_queue_init(CAPTURE_NBUFS, &gRing, 0) == 0);
+  gOffset  = 0;
+#endif
+
+  if (pthread_create(&gWriter, NULL, writer, NULL) != 0) {
+    fprintf(stderr, "ERROR: Cannot start the capture writer thread\n");
+    return false;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &gStart);
+  return true;
+}
+
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static inline char *
+hex(char *p, uint64_t val, unsigned int minDigits)
+{
+  char tmp[16];
+  unsigned int n = 0;
+  do {
+    tmp[n++] = hexDigits[val & 0xf];
+    val >>= 4;
+  } while (val != 0 || n < minDigits);
+
+  while (n > 0) *p++ = tmp[--n];
+  return p;
+}
+
+
+void
+captureSample(uint16_t chan0, uint16_t chan1, uint64_t stamp)
+{
+  // Same as "%04x %04x %08llx\n", without going through printf
+  char line[40];
+  char *p = hex(line, chan0, 4);
+  *p++ = ' ';
+  p = hex(p, chan1, 4);
+  *p++ = ' ';
+  p = hex(p, stamp, 8);
+  *p++ = '\n';
+  size_t len = p - line;
+
+  // Lines straddle buffers so full buffers are always exactly CAPTURE_BUFSIZE
+  size_t n = CAPTURE_BUFSIZE - gPos;
+  if (n > len) n = len;
+  memcpy(gBufs[gFill] + gPos, line, n);
+  gPos += n;
+
+  if (gPos == CAPTURE_BUFSIZE) {
+    handOff();
+    memcpy(gBufs[gFill], line + n, len - n);
+    gPos = len - n;
+  }
+}
+
+
+void
+captureClose()
+{
+  if (gFd < 0) return;
+
+  if (gPos > 0) handOff();
+
+  pthread_mutex_lock(&gLock);
+  gIsClosing = true;
+  pthread_cond_signal(&gFullCond);
+  pthread_mutex_unlock(&gLock);
+  pthread_join(gWriter, NULL);
+
+  gStats.elapsed = since(gStart);
+
+#ifdef HAVE_LIBURING
+  if (gHasRing) io_uring_queue_exit(&gRing);
+#endif
+  close(gFd);
+  gFd = -1;
+
+  for (unsigned int i = 0; i < CAPTURE_NBUFS; i++) free(gBufs[i]);
+}
+
+
+const captureStats_t &
+captureStats()
+{
+  return gStats;
+}
@@ -0,0 +1,55 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+
+//
+// Records the raw samples, in the format read back with 'CarCounter -r'.
+//
+// The sampler formats the samples into large preallocated buffers. Full
+// buffers are handed to a writer thread, so a slow storage device only
+// stalls the sampler if all of the buffers are waiting to be written.
+//
+
+#define CAPTURE_NBUFS    4
+#define CAPTURE_BUFSIZE  (1024 * 1024)
+
+typedef struct captureStats_s {
+  uint64_t bytes;
+  uint64_t writes;
+  // Number of times the sampler had to wait for a buffer to be written
+  uint64_t fullWaits;
+  // Longest time a single write took (us)
+  uint64_t worstWrite;
+  double   elapsed;
+} captureStats_t;
+
+
+bool captureOpen(const char *fname);
+
+void captureSample(uint16_t chan0, uint16_t chan1, uint64_t stamp);
+
+//
+// Write out the remaining samples and stop the writer thread
+//
+void captureClose();
+
+const captureStats_t &captureStats();
+
+#endif
@@ -0,0 +1,203 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <string.h>
+
+#include "classify.h"
+
+
+// Feet travelled in one ms at 1 MPH
+#define FT_PER_MS_MPH 0.00147
+
+// Axles further apart than this are on different vehicles
+#define MAX_AXLE_SPACING 40.0
+
+// A car's trailer axle is no further than this behind the previous axle, so
+// a longer gap after a car's wheelbase is the next vehicle following closely
+#define MAX_TRAILER_SPACING 20.0
+
+// Longest wheelbase of a car or pickup, and longest spacing within a tandem
+#define MAX_CAR_WHEELBASE 13.3
+#define MAX_TANDEM_SPACING 6.0
+
+// Axles on the same vehicle must be measured at about the same speed
+#define MAX_SPEED_DIFF 5.0
+
+// ...and at the very same speed when far behind a car's wheelbase, as the
+// trailer of a tractor whose tandem was detected as a single axle
+#define MAX_TRAILER_SPEED_DIFF 1.0
+
+
+static void (*gSink)(const vehicle_t &) = NULL;
+
+//
+// Vehicle being assembled in each direction
+//
+static struct pending_s {
+  vehicle_t vehicle;
+  uint64_t  lastAxle;
+  double    mphSum;
+  uint64_t  deadline;
+  bool      isValid;
+} gPending[2];
+
+
+void
+classifyInit(void (*sink)(const vehicle_t &))
+{
+  gSink = sink;
+  bzero(gPending, sizeof(gPending));
+}
+
+
+//
+// Approximation of the FHWA 13-category scheme, from the number of axles
+// and their spacing only
+//
+static unsigned int
+fhwaClass(const vehicle_t &v)
+{
+  unsigned int tandems = 0;
+  unsigned int longs   = 0;
+  for (unsigned int i = 1; i + 1 < v.nAxles && i < CLASSIFY_MAX_AXLES - 1; i++) {
+    if (v.spacing[i] < 6.0)   tandems++;
+    if (v.spacing[i] >= 11.0) longs++;
+  }
+
+  switch (v.nAxles) {
+  case 0:
+  case 1:
+    return 0;
+
+  case 2:
+    if (v.spacing[0] <  6.0) return 1;   // Motorcycle
+    if (v.spacing[0] < 10.2) return 2;   // Passenger car
+    if (v.spacing[0] < 13.3) return 3;   // Pickup, van
+    if (v.spacing[0] < 23.0) return 5;   // Two-axle, six-tire single unit
+    return 4;                            // Bus
+
+  case 3:
+    if (tandems == 1) return 6;          // Three-axle single unit
+    if (v.spacing[0] < 13.3) return 3;   // Car or pickup with a one-axle trailer
+    return 8;                            // Single trailer
+
+  case 4:
+    if (tandems == 2) return 7;          // Four-or-more axle single unit
+    if (v.spacing[0] < 13.3) return 3;   // Car or pickup with a two-axle trailer
+    return 8;                            // Single trailer
+
+  case 5:
+    return (longs >= 3) ? 11 : 9;        // Multi-trailer or single trailer
+
+  case 6:
+    return (longs >= 3) ? 12 : 10;
+
+  default:
+    return 13;
+  }
+}
+
+
+//
+// Can an axle 'feet' behind the last one, measured 'diff' MPH faster, be on vehicle 'v'?
+//
+static bool
+isSameVehicle(const vehicle_t &v, double feet, double diff)
+{
+  if (feet > MAX_AXLE_SPACING || diff <= -MAX_SPEED_DIFF || MAX_SPEED_DIFF <= diff) return false;
+  if (feet <= MAX_TRAILER_SPACING) return true;
+
+  // The first axle may be the steering axle of a truck or bus
+  if (v.nAxles < 2) return true;
+
+  // Trucks, and tractors with their tandem, can pull a long trailer
+  if (v.spacing[0] >= MAX_CAR_WHEELBASE) return true;
+  for (unsigned int i = 1; i + 1 < v.nAxles && i < CLASSIFY_MAX_AXLES - 1; i++) {
+    if (v.spacing[i] < MAX_TANDEM_SPACING) return true;
+  }
+
+  // Otherwise, most likely the next vehicle following closely
+  return -MAX_TRAILER_SPEED_DIFF < diff && diff < MAX_TRAILER_SPEED_DIFF;
+}
+
+
+static void
+complete(struct pending_s &p)
+{
+  vehicle_t &v = p.vehicle;
+
+  v.mph    = p.mphSum / v.nAxles;
+  v.length = 0;
+  for (unsigned int i = 0; i + 1 < v.nAxles && i < CLASSIFY_MAX_AXLES - 1; i++) {
+    v.length += v.spacing[i];
+  }
+  v.fhwaClass = fhwaClass(v);
+
+  gSink(v);
+  p.isValid = false;
+}
+
+
+void
+classifyAxle(uint64_t stamp, double mph, bool isUp)
+{
+  struct pending_s &p = gPending[isUp];
+
+  if (p.isValid) {
+    // Normalize the time since the last axle to a distance, using the speed
+    // of the vehicle so far
+    double vmph = p.mphSum / p.vehicle.nAxles;
+    double feet = FT_PER_MS_MPH * (stamp - p.lastAxle) * vmph;
+    double diff = mph - vmph;
+
+    if (isSameVehicle(p.vehicle, feet, diff)) {
+      if (p.vehicle.nAxles < CLASSIFY_MAX_AXLES) p.vehicle.spacing[p.vehicle.nAxles - 1] = feet;
+      p.vehicle.nAxles++;
+      p.mphSum   += mph;
+      p.lastAxle  = stamp;
+      p.deadline  = stamp + (uint64_t) (MAX_AXLE_SPACING / (FT_PER_MS_MPH * (p.mphSum / p.vehicle.nAxles)));
+      return;
+    }
+
+    // A different vehicle
+    complete(p);
+  }
+
+  bzero(&p.vehicle, sizeof(p.vehicle));
+  p.vehicle.stamp  = stamp;
+  p.vehicle.isUp   = isUp;
+  p.vehicle.nAxles = 1;
+  p.mphSum   = mph;
+  p.lastAxle = stamp;
+  p.deadline = stamp + (uint64_t) (MAX_AXLE_SPACING / (FT_PER_MS_MPH * mph));
+  p.isValid  = true;
+}
+
+
+void
+classifyTick(uint64_t stamp)
+{
+  if (gPending[0].isValid && stamp > gPending[0].deadline) complete(gPending[0]);
+  if (gPending[1].isValid && stamp > gPending[1].deadline) complete(gPending[1]);
+}
+
+
+void
+classifyFlush()
+{
+  if (gPending[0].isValid) complete(gPending[0]);
+  if (gPending[1].isValid) complete(gPending[1]);
+}
@@ -0,0 +1,62 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __CLASSIFY_H__
+#define __CLASSIFY_H__
+
+#include <stdint.h>
+
+//
+// Groups the axles detected by the hoses into vehicles.
+//
+// Consecutive axles travelling in the same direction at about the same speed
+// belong to the same vehicle if they are close enough once the time between
+// them is converted into a distance. A long gap after the wheelbase of a car
+// is the next vehicle, but may be a trailer behind a truck. A vehicle is
+// complete once no other axle can belong to it.
+//
+
+#define CLASSIFY_MAX_AXLES 8
+
+typedef struct vehicle_s {
+  uint64_t     stamp;      // Time the first axle was detected (ms)
+  double       mph;        // Average speed of all axles
+  bool         isUp;
+  unsigned int nAxles;
+  double       spacing[CLASSIFY_MAX_AXLES - 1];  // Between consecutive axles (ft)
+  double       length;     // From the first to the last axle (ft)
+  unsigned int fhwaClass;
+} vehicle_t;
+
+
+void classifyInit(void (*sink)(const vehicle_t &));
+
+//
+// Record an axle detected at 'stamp' (ms)
+//
+void classifyAxle(uint64_t stamp, double mph, bool isUp);
+
+//
+// Let time pass, completing the vehicles that cannot have more axles
+//
+void classifyTick(uint64_t stamp);
+
+//
+// Complete all pending vehicles
+//
+void classifyFlush();
+
+#endif
@@ -0,0 +1,193 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <string.h>
+
+#include "dedup.h"
+
+
+static dedupConfig_t gCfg = {10, 3, 5.0, false};
+static bool        (*gSink)(event_t) = NULL;
+static dedupStats_t  gStats;
+
+//
+// Reorder buffer: a ring of events sorted by time stamp
+//
+static event_t      gRing[DEDUP_DEPTH];
+static unsigned int gHead = 0;
+static unsigned int gCount = 0;
+// Most recent time stamp seen and time stamp of the last event released
+static time_t       gNewest = 0;
+static time_t       gReleased = 0;
+
+//
+// Pending event in each lane, for each direction
+//
+static struct {
+  event_t ev;
+  bool    isValid;
+} gPending[DEDUP_MAX_LANES][2];
+
+
+void
+dedupInit(const dedupConfig_t &cfg, bool (*sink)(event_t))
+{
+  gCfg  = cfg;
+  gSink = sink;
+  dedupBegin();
+}
+
+
+void
+dedupBegin()
+{
+  gHead     = 0;
+  gCount    = 0;
+  gNewest   = 0;
+  gReleased = 0;
+  bzero(gPending, sizeof(gPending));
+  bzero(&gStats, sizeof(gStats));
+}
+
+
+const dedupStats_t &
+dedupStats()
+{
+  return gStats;
+}
+
+
+//
+// Merge an in-order event with the pending event in the same lane and direction
+//
+static void
+mergeEvent(event_t ev)
+{
+  // Pending events in the other lanes that are too old to be merged can go
+  for (unsigned int l = 0; l < DEDUP_MAX_LANES; l++) {
+    for (unsigned int d = 0; d < 2; d++) {
+      if (gPending[l][d].isValid && gPending[l][d].ev.stamp + gCfg.mergeWin < ev.stamp) {
+	gSink(gPending[l][d].ev);
+	gPending[l][d].isValid = false;
+      }
+    }
+  }
+
+  auto &pending = gPending[ev.lane][ev.isUp];
+
+  if (!pending.isValid) {
+    pending.ev      = ev;
+    pending.isValid = true;
+    return;
+  }
+
+  // Two vehicles with their axles grouped are two vehicles following closely,
+  // but a stray axle may be a repeat of the other one
+  if (pending.ev.nAxles > 1 && ev.nAxles > 1) {
+    gSink(pending.ev);
+    pending.ev = ev;
+    return;
+  }
+
+  // Two events, seperated by 'mergeWin' sec or less are the same car
+  gStats.merged++;
+
+  // If the two speeds are too far apart, there's been a glitch
+  double diff = ev.speed - pending.ev.speed;
+  if (-gCfg.maxSpeedDiff < diff && diff < gCfg.maxSpeedDiff) {
+    // Average the speed
+    ev.speed = (ev.speed + pending.ev.speed) / 2;
+    ev.stamp = pending.ev.stamp;
+  } else {
+    gStats.mismatched++;
+    if (gCfg.keepFirst) ev = pending.ev;
+    // Ignore the speed
+    else ev.speed = 0.0;
+  }
+
+  gSink(ev);
+  pending.isValid = false;
+}
+
+
+//
+// Release the oldest event in the reorder buffer
+//
+static void
+releaseEvent()
+{
+  event_t ev = gRing[gHead];
+  gHead = (gHead + 1) % DEDUP_DEPTH;
+  gCount--;
+
+  gReleased = ev.stamp;
+  mergeEvent(ev);
+}
+
+
+void
+dedupEvent(event_t ev)
+{
+  gStats.events++;
+
+  // Merging it with a car in another lane would lose both
+  if (ev.lane >= DEDUP_MAX_LANES) {
+    gStats.badLane++;
+    return;
+  }
+
+  // Make room, which may release events younger than this one
+  if (gCount == DEDUP_DEPTH) releaseEvent();
+
+  if (gReleased > 0 && ev.stamp < gReleased) {
+    // Too late: younger events have already been released
+    gStats.dropped++;
+    return;
+  }
+
+  // Insert in order, from the tail. Input is almost always sorted so this is
+  // O(1) amortized, bounded by how far out of order the event is.
+  unsigned int i = gCount++;
+  while (i > 0) {
+    event_t &prev = gRing[(gHead + i - 1) % DEDUP_DEPTH];
+    if (prev.stamp <= ev.stamp) break;
+    gRing[(gHead + i) % DEDUP_DEPTH] = prev;
+    i--;
+  }
+  gRing[(gHead + i) % DEDUP_DEPTH] = ev;
+  if (i < gCount - 1) gStats.outOfOrder++;
+
+  if (ev.stamp > gNewest) gNewest = ev.stamp;
+
+  // Release the events that are now outside of the reorder window
+  while (gCount > 0 && gRing[gHead].stamp + gCfg.reorderWin < gNewest) {
+    releaseEvent();
+  }
+}
+
+
+void
+dedupFlush()
+{
+  while (gCount > 0) releaseEvent();
+
+  for (unsigned int l = 0; l < DEDUP_MAX_LANES; l++) {
+    for (unsigned int d = 0; d < 2; d++) {
+      if (gPending[l][d].isValid) gSink(gPending[l][d].ev);
+      gPending[l][d].isValid = false;
+    }
+  }
+}
@@ -0,0 +1,85 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <time.h>
+
+typedef struct event_s {
+  time_t       stamp;
+  double       speed;
+  bool         isUp;
+  unsigned int lane;
+  unsigned int nAxles;     // 0 if the axles were not grouped into a vehicle
+} event_t;
+
+//
+// Streaming de-duplication of the events reported by the CarCounter.
+//
+// Events first go through a reorder buffer that holds them for a bounded
+// time window so they come out sorted. They are then matched against the
+// pending event in the same lane and direction: two events close enough
+// in time are the same car and are merged into one, unless both have
+// more than one axle.
+//
+
+#define DEDUP_MAX_LANES   4
+#define DEDUP_DEPTH     256
+
+typedef struct dedupConfig_s {
+  // How long (in seconds) events are held to be put back in order
+  time_t reorderWin;
+  // Two events in the same lane and direction within that many seconds are the same car
+  time_t mergeWin;
+  // Merged events whose speeds differ by that many MPH or more are a glitch...
+  double maxSpeedDiff;
+  // ...in which case keep the speed of the first event instead of ignoring the speed
+  bool   keepFirst;
+} dedupConfig_t;
+
+typedef struct dedupStats_s {
+  unsigned long events;
+  unsigned long merged;
+  unsigned long mismatched;
+  unsigned long outOfOrder;
+  // Events that arrived after younger events had already left the reorder buffer
+  unsigned long dropped;
+  // Events in lane DEDUP_MAX_LANES or above, which are also dropped
+  unsigned long badLane;
+} dedupStats_t;
+
+
+//
+// Set the merge rules and where the de-duplicated events go
+//
+void dedupInit(const dedupConfig_t &cfg, bool (*sink)(event_t));
+
+//
+// Start a new stream, clearing the buffers and statistics
+//
+void dedupBegin();
+
+void dedupEvent(event_t ev);
+
+//
+// Push out all events still held at the end of the stream
+//
+void dedupFlush();
+
+const dedupStats_t &dedupStats();
+
+#endif
@@ -0,0 +1,451 @@
+//
+// Copyright 2017 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "classify.h"
+#include "detector.h"
+
+
+unsigned int gDebug = 0;
+
+//
+// Detector tuning for each site. The detector is specialized for each of
+// them, so that all of these are compile-time constants in the code that
+// processes every sample.
+//
+struct defaultSite {
+  static constexpr unsigned int nChannels    = 2;
+  // Samples outside of that range are obviously bad
+  static constexpr uint16_t     minPressure  = 0x0180;
+  static constexpr uint16_t     maxPressure  = 0x1000;
+  // High and low pressure, above the baseline
+  static constexpr uint16_t     highPressure = 0x0c0;
+  static constexpr uint16_t     lowPressure  = 0x020;
+  // Consecutive high-pressure samples to detect an axle...
+  static constexpr uint32_t     highCount    = 20;
+  // ...and low-pressure samples to be idle again
+  static constexpr uint32_t     lowCount     = 60;
+  // One sample in 2^baselineShift goes into the baseline window
+  static constexpr unsigned int baselineShift = 5;
+  // A hose that has not been idle for that long is stuck (ms)
+  static constexpr long long    stuckMs      = 3000;
+  // Slowest detection across both hoses (ms)
+  static constexpr long long    maxMs        = 2000;
+  // Speed (MPH) that takes 1 ms to cover the distance between the hoses
+  static constexpr double       mphMs        = 681.8;
+};
+
+// Long or soft hoses, with weaker pulses
+struct sensitiveSite : defaultSite {
+  static constexpr uint16_t     highPressure = 0x080;
+  static constexpr uint16_t     lowPressure  = 0x018;
+  static constexpr uint32_t     highCount    = 12;
+};
+
+// Noisy ADC or hoses subject to vibrations
+struct noisySite : defaultSite {
+  static constexpr uint16_t     highPressure = 0x100;
+  static constexpr uint16_t     lowPressure  = 0x040;
+  static constexpr unsigned int baselineShift = 6;
+};
+
+// Hoses 24 inches apart, for faster traffic
+struct wideSite : defaultSite {
+  static constexpr long long    maxMs        = 4000;
+  static constexpr double       mphMs        = 1363.6;
+};
+
+
+//
+// The baseline is the median of the recent samples, so it follows the idle
+// pressure while axles cross the hose, and catches up with a hose that stays
+// pressed. A histogram of the samples in the window is kept along with the
+// median. Each new sample moves the median by one rank, which the histogram
+// finds by skipping over whole buckets of levels: at most two partial buckets
+// and one step per bucket in between, even when the median jumps after a hose
+// is released.
+//
+#define BASELINE_LEN     256
+#define BASELINE_RANK    (BASELINE_LEN / 2)
+// 12-bit ADC, plus the largest valid sample
+#define BASELINE_LEVELS  (0x1000 + 1)
+#define BUCKET_SHIFT     6
+#define BUCKET_LEVELS    (1 << BUCKET_SHIFT)
+#define BASELINE_BUCKETS ((BASELINE_LEVELS + BUCKET_LEVELS - 1) / BUCKET_LEVELS)
+
+struct baseline_s {
+  uint16_t window[BASELINE_LEN];
+  uint16_t hist[BASELINE_LEVELS];
+  uint16_t buckets[BASELINE_BUCKETS];
+  unsigned int next;
+  unsigned int skip;
+  // The percentile, and how many samples in the window are below it
+  uint16_t level;
+  unsigned int below;
+};
+
+struct channel_s {
+  struct baseline_s baseline;
+  bool     isIdle;
+  bool     isChanging;
+  uint32_t changeCount;
+  uint64_t detectTime;
+  bool     hasEvent;
+};
+
+
+template<class SITE>
+struct detector_s {
+  static_assert(SITE::nChannels == 2, "The MCP3202 has two channels, for one pair of hoses");
+
+  static struct channel_s channelData[SITE::nChannels];
+
+  static_assert(SITE::maxPressure < BASELINE_LEVELS, "Valid samples must fit in the baseline histogram");
+
+  static unsigned int
+  average(unsigned int chan)
+  {
+    return channelData[chan].baseline.level;
+  }
+
+  static void initBaseline(unsigned int chan, uint16_t pressure);
+  static void updateBaseline(unsigned int chan, uint16_t pressure);
+  static void init(uint16_t chan0, uint16_t chan1);
+  static void analyzeChannel(unsigned int chan, uint16_t pressure, uint64_t stamp);
+  static void analyzeSample(uint16_t chan0, uint16_t chan1, uint64_t stamp);
+};
+
+template<class SITE>
+struct channel_s detector_s<SITE>::channelData[SITE::nChannels];
+
+
+static detectorStats_t gStats;
+
+
+template<class SITE>
+void
+detector_s<SITE>::initBaseline(unsigned int chan,
+				uint16_t     pressure)
+{
+  struct baseline_s &bl = channelData[chan].baseline;
+
+  for (unsigned int i = 0; i < BASELINE_LEN; i++) bl.window[i] = pressure;
+  memset(bl.hist, 0, sizeof(bl.hist));
+  memset(bl.buckets, 0, sizeof(bl.buckets));
+  bl.hist[pressure] = BASELINE_LEN;
+  bl.buckets[pressure >> BUCKET_SHIFT] = BASELINE_LEN;
+  bl.next  = 0;
+  bl.skip  = 0;
+  bl.level = pressure;
+  bl.below = 0;
+}
+
+
+template<class SITE>
+void
+detector_s<SITE>::updateBaseline(unsigned int chan,
+				  uint16_t     pressure)
+{
+  struct baseline_s &bl = channelData[chan].baseline;
+
+  if (++bl.skip < (1U << SITE::baselineShift)) return;
+  bl.skip = 0;
+
+  // Replace the oldest sample in the window
+  uint16_t oldest = bl.window[bl.next];
+  bl.window[bl.next] = pressure;
+  bl.next = (bl.next + 1) % BASELINE_LEN;
+
+  bl.hist[oldest]--;
+  bl.buckets[oldest >> BUCKET_SHIFT]--;
+  if (oldest < bl.level) bl.below--;
+  bl.hist[pressure]++;
+  bl.buckets[pressure >> BUCKET_SHIFT]++;
+  if (pressure < bl.level) bl.below++;
+
+  // Move the median to the level that holds the sample of that rank,
+  // skipping the buckets it cannot be in
+  while (bl.below > BASELINE_RANK) {
+    unsigned int bucket = bl.level >> BUCKET_SHIFT;
+    if ((bl.level & (BUCKET_LEVELS - 1)) == 0 && bl.below - bl.buckets[bucket - 1] > BASELINE_RANK) {
+      bl.below -= bl.buckets[bucket - 1];
+      bl.level -= BUCKET_LEVELS;
+      continue;
+    }
+    bl.level--;
+    bl.below -= bl.hist[bl.level];
+  }
+  while (bl.below + bl.hist[bl.level] <= BASELINE_RANK) {
+    unsigned int bucket = bl.level >> BUCKET_SHIFT;
+    if ((bl.level & (BUCKET_LEVELS - 1)) == 0 && bl.below + bl.buckets[bucket] <= BASELINE_RANK) {
+      bl.below += bl.buckets[bucket];
+      bl.level += BUCKET_LEVELS;
+      continue;
+    }
+    bl.below += bl.hist[bl.level];
+    bl.level++;
+  }
+}
+
+
+template<class SITE>
+void
+detector_s<SITE>::analyzeChannel(unsigned int chan,
+				  uint16_t     pressure,
+				  uint64_t     stamp)
+{
+  // Reject obviously bad samples
+  if (pressure < SITE::minPressure || SITE::maxPressure < pressure) return;
+
+  char HxL = 'x';
+  
+  if (pressure >= average(chan) + SITE::highPressure) {
+
+    // High pressure detected
+    HxL = 'H';
+    
+    if (channelData[chan].isIdle) {
+      // Are we in the middle of a transition?
+      if (channelData[chan].isChanging) {
+	// Have we reached the end of the transition?
+	// Must see 'highCount' consecutive high-pressure samples
+	if (channelData[chan].changeCount++ >= SITE::highCount) {
+
+	  channelData[chan].isIdle      = false;
+	  channelData[chan].isChanging  = false;
+	  channelData[chan].changeCount = 0;
+	  channelData[chan].detectTime = stamp;
+	  channelData[chan].hasEvent    = true;
+
+	  if (gDebug > 0) {
+	    unsigned int otherChan = ((chan + 1) & 0x1);
+	    if (channelData[otherChan].hasEvent) {
+	      printf("DTCT %d %04x > %04x at %08llx with pending event on %d %lld ms ago\n",
+		     chan, pressure, average(chan), (unsigned long long) stamp,
+		     otherChan, (long long) (stamp - channelData[otherChan].detectTime));
+	    } else {
+	      printf("DTCT %d %04x > %04x at %08llx with no event on %d\n",
+		     chan, pressure, average(chan), (unsigned long long) stamp, otherChan);
+	    }
+	  }
+	}
+	
+      } else {
+	// We started changing
+	channelData[chan].isChanging = true;
+	channelData[chan].changeCount = 1;
+      }
+    } else {
+      // A single high-pressure sample cancels a low-pressure transition
+      channelData[chan].isChanging  = false;
+      channelData[chan].changeCount = 0;
+    }
+
+  } else if (pressure <= average(chan) + SITE::lowPressure) {
+
+    // Low ressure detected
+    HxL = 'L';
+    
+    if (not channelData[chan].isIdle) {
+      // Are we in the middle of a transition?
+      if (channelData[chan].isChanging) {
+	// Must see 'lowCount' consecutive low-pressure samples
+	if (channelData[chan].changeCount++ >= SITE::lowCount) {
+
+	  channelData[chan].isIdle      = true;
+	  channelData[chan].isChanging  = false;
+	  channelData[chan].changeCount = 0;
+	  
+	  if (gDebug > 0) {
+	    printf("IDLE %d %04x < %04x at %08llx\n",
+		   chan, pressure, average(chan), (unsigned long long) stamp);
+	  }
+	}
+	
+      } else {
+	// We started changing
+	channelData[chan].isChanging = true;
+	channelData[chan].changeCount = 1;
+      }
+    } else {
+      // A single low-pressure sample cancels a high-pressure transition
+      channelData[chan].isChanging  = false;
+      channelData[chan].changeCount = 0;
+    }
+  }
+  
+  if (gDebug > 1) {
+    printf("%04x %04x %c %08llx %c%s%3d    ", pressure, average(chan), HxL, (unsigned long long) stamp,
+	   channelData[chan].isIdle ? 'L' : 'H',
+	   channelData[chan].isChanging ? "->" : "  ",
+	   channelData[chan].changeCount);
+  }
+  
+
+  // Pressed for much longer than any axle: start over from the current pressure
+  if (!channelData[chan].isIdle && stamp - channelData[chan].detectTime > (uint64_t) SITE::stuckMs) {
+    if (gDebug > 0) {
+      printf("STCK %d %04x > %04x at %08llx since %08llx\n",
+	     chan, pressure, average(chan), (unsigned long long) stamp,
+	     (unsigned long long) channelData[chan].detectTime);
+    }
+    channelData[chan].isIdle      = true;
+    channelData[chan].isChanging  = false;
+    channelData[chan].changeCount = 0;
+    gStats.recoveries[chan]++;
+    initBaseline(chan, pressure);
+    return;
+  }
+
+  updateBaseline(chan, pressure);
+}
+
+  
+template<class SITE>
+void
+detector_s<SITE>::analyzeSample(uint16_t chan0,
+				 uint16_t chan1,
+				 uint64_t stamp)
+{
+  analyzeChannel(0, chan0, stamp);
+  analyzeChannel(1, chan1, stamp);
+  if (gDebug > 1) {
+    printf("\n");
+  }
+
+  // Complete the vehicles that cannot have more axles
+  classifyTick(stamp);
+
+  // Do we have an event recorded on both channels?
+  if (!channelData[0].hasEvent || !channelData[1].hasEvent) return;
+
+  // Which one occured first?
+  long long int ms = channelData[0].detectTime - channelData[1].detectTime;
+
+  bool isUp = true;
+  if (ms < 0) {
+    isUp = false;
+    ms = -ms;
+  }
+
+  // Both hoses in the same ms cannot tell the direction, nor give a finite speed
+  if (ms == 0) {
+    channelData[0].hasEvent = false;
+    channelData[1].hasEvent = false;
+    return;
+  }
+
+  // Reject detections that are way to slow
+  if (ms > SITE::maxMs) {
+    // But save the latest event to recover
+    if (isUp) channelData[1].hasEvent = false;
+    else channelData[0].hasEvent = false;
+    return;
+  }
+
+  // If it takes 'ms' to cover the distance between the hoses, what is the speed?
+  double mph = SITE::mphMs / ms;
+
+  // Marked these event has handled
+  channelData[0].hasEvent = false;
+  channelData[1].hasEvent = false;
+
+  // Group the axles into vehicles (It does not matter which hose we use)
+  if (gDebug > 0) {
+    printf("AXLE %d %6.1f MPH at %08llx\n", isUp, mph, (unsigned long long) channelData[1].detectTime);
+  }
+  classifyAxle(channelData[1].detectTime, mph, isUp);
+}
+
+
+template<class SITE>
+void
+detector_s<SITE>::init(uint16_t chan0,
+		       uint16_t chan1)
+{
+  for (unsigned int chan = 0; chan < SITE::nChannels; chan++) {
+    channelData[chan].isIdle      = true;
+    channelData[chan].isChanging  = false;
+    channelData[chan].changeCount = 0;
+    channelData[chan].detectTime  = 0;
+    channelData[chan].hasEvent    = false;
+  }
+  // The first samples may be bad too
+  initBaseline(0, (chan0 <= SITE::maxPressure) ? chan0 : SITE::maxPressure);
+  initBaseline(1, (chan1 <= SITE::maxPressure) ? chan1 : SITE::maxPressure);
+  memset(&gStats, 0, sizeof(gStats));
+}
+
+
+//
+// Dispatch table of the supported sites
+//
+static const struct site_s {
+  const char *name;
+  const char *descr;
+  void      (*init)(uint16_t, uint16_t);
+  void      (*analyzeSample)(uint16_t, uint16_t, uint64_t);
+} sites[] = {
+  {"default",   "12-inch hose spacing",                 detector_s<defaultSite>::init,   detector_s<defaultSite>::analyzeSample},
+  {"sensitive", "long or soft hoses, weaker pulses",    detector_s<sensitiveSite>::init, detector_s<sensitiveSite>::analyzeSample},
+  {"noisy",     "noisy ADC or vibrating hoses",         detector_s<noisySite>::init,     detector_s<noisySite>::analyzeSample},
+  {"wide",      "24-inch hose spacing",                 detector_s<wideSite>::init,      detector_s<wideSite>::analyzeSample},
+};
+
+static const struct site_s *gSite = &sites[0];
+
+void (*analyzeSample)(uint16_t, uint16_t, uint64_t) = detector_s<defaultSite>::analyzeSample;
+
+
+bool
+detectorSelect(const char *name)
+{
+  for (unsigned int i = 0; i < sizeof(sites)/sizeof(sites[0]); i++) {
+    if (strcmp(name, sites[i].name) == 0) {
+      gSite = &sites[i];
+      analyzeSample = gSite->analyzeSample;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void
+detectorList(FILE *fp)
+{
+  for (unsigned int i = 0; i < sizeof(sites)/sizeof(sites[0]); i++) {
+    fprintf(fp, "                     %-10s %s\n", sites[i].name, sites[i].descr);
+  }
+}
+
+
+void
+detectorInit(uint16_t chan0,
+	     uint16_t chan1)
+{
+  gSite->init(chan0, chan1);
+}
+
+
+const detectorStats_t &
+detectorStats()
+{
+  return gStats;
+}
@@ -0,0 +1,61 @@
+//
+// Copyright 2017 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __DETECTOR_H__
+#define __DETECTOR_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+//
+// Detects the axles crossing the pair of hoses from the raw pressure samples,
+// and hands them to the vehicle classifier.
+//
+
+extern unsigned int gDebug;
+
+
+//
+// Select the detector tuned for a site. Returns false if there is no such site.
+//
+bool detectorSelect(const char *name);
+
+//
+// List the supported sites
+//
+void detectorList(FILE *fp);
+
+//
+// Reset the detector, with the idle pressure on each hose
+//
+void detectorInit(uint16_t chan0, uint16_t chan1);
+
+//
+// Points to the detector for the selected site
+//
+extern void (*analyzeSample)(uint16_t chan0, uint16_t chan1, uint64_t stamp);
+
+//
+// Hoses that stayed pressed for so long that the detector gave up on them
+// and started over from their current pressure, since detectorInit()
+//
+typedef struct detectorStats_s {
+  unsigned long long recoveries[2];
+} detectorStats_t;
+
+const detectorStats_t &detectorStats();
+
+#endif
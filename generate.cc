@@ -0,0 +1,413 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+//
+// Synthesize the raw two-channel ADC samples that the CarCounter would
+// record with '-w', for traffic with known characteristics, and the list of
+// vehicles that should be detected in them.
+//
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// Feet travelled in one ms at 1 MPH
+#define FT_PER_MS_MPH 0.00147
+
+// Distance between the two hoses (ft)
+#define HOSE_SPACING 1.0
+
+// Duration over which a pulse is not negligible (ms)
+#define PULSE_LEN 600.0
+
+// Pulse shape: a quick rise, a plateau while the tire is on the hose, then an exponential decay
+#define PULSE_RISE   4.0
+#define PULSE_TAU   60.0
+#define TIRE_LENGTH  0.6
+
+// Extra pressure on a stuck hose (ADC counts)
+#define STUCK_PRESSURE 0x140
+
+unsigned int gSeed      = 1;
+double       gDuration  = 3600;     // Seconds
+double       gRate      = 1000;     // Samples per second
+double       gVehicles  = 120;      // Vehicles per hour
+double       gSpeed     = 20;       // Average speed (MPH)
+double       gSpeedDev  = 4;        // Standard deviation of the speed (MPH)
+double       gUpRatio   = 0.5;      // Fraction of vehicles travelling uphill
+double       gTrucks    = 0.1;      // Fraction of vehicles with more than 2 axles
+double       gNoise     = 6;        // Standard deviation of the noise (ADC counts)
+double       gDrift     = 0x20;     // Amplitude of the baseline drift (ADC counts)
+double       gDriftPer  = 1800;     // Period of the baseline drift (sec)
+double       gBad       = 0.0001;   // Probability of a bad sample
+double       gStuck     = 0;        // Time hose 0 is held down halfway through (sec)
+double       gHeadway   = 2;        // Minimum time between vehicles in the same direction (sec)
+uint64_t     gStart     = 0x16200000000ULL;  // ms
+bool         gIsLog     = false;
+double       gGlitch    = 0;        // Fraction of vehicles logged twice or late
+
+
+//
+// Deterministic random number generator (xorshift64*), so that the same seed
+// always produces the same capture
+//
+static uint64_t gRng;
+
+static double
+uniform()
+{
+  gRng ^= gRng >> 12;
+  gRng ^= gRng << 25;
+  gRng ^= gRng >> 27;
+  return ((gRng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double
+uniform(double min, double max)
+{
+  return min + (max - min) * uniform();
+}
+
+static double
+gaussian(double mean, double dev)
+{
+  double u = uniform();
+  if (u < 1e-12) u = 1e-12;
+  return mean + dev * sqrt(-2 * log(u)) * cos(2 * M_PI * uniform());
+}
+
+
+//
+// Axle spacings (ft) of the vehicles that are generated
+//
+static const struct profile_s {
+  unsigned int fhwaClass;
+  unsigned int nAxles;
+  double       minSpacing[4];
+  double       maxSpacing[4];
+} profiles[] = {
+  {2, 2, { 8.5},                 {10.0}},
+  {3, 2, {10.5},                 {13.0}},
+  {5, 2, {14.0},                 {20.0}},
+  {6, 3, {15.0, 4.0},            {20.0,  4.5}},
+  {9, 5, {11.0, 4.0, 30.0, 4.0}, {14.0,  4.5, 38.0, 4.5}},
+};
+
+typedef struct pulse_s {
+  double       start;   // ms since the start of the capture
+  double       length;  // ms the tire is on the hose
+  double       amplitude;
+  unsigned int chan;
+} pulse_t;
+
+static pulse_t      *gPulses  = NULL;
+static unsigned int  gNPulses = 0;
+static unsigned int  gMaxPulses = 0;
+
+
+static void
+addPulse(double start, double length, double amplitude, unsigned int chan)
+{
+  if (gNPulses == gMaxPulses) {
+    gMaxPulses = (gMaxPulses == 0) ? 1024 : gMaxPulses * 2;
+    gPulses = (pulse_t *) realloc(gPulses, gMaxPulses * sizeof(pulse_t));
+    if (gPulses == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory for %d pulses\n", gMaxPulses);
+      exit(-1);
+    }
+  }
+  gPulses[gNPulses++] = {start, length, amplitude, chan};
+}
+
+
+static int
+cmpPulse(const void *a, const void *b)
+{
+  double diff = ((const pulse_t *) a)->start - ((const pulse_t *) b)->start;
+  return (diff < 0) ? -1 : (diff > 0);
+}
+
+
+static double
+pulse(const pulse_t &p, double t)
+{
+  double dt = t - p.start;
+  if (dt < 0) return 0;
+  if (dt < PULSE_RISE) return p.amplitude * dt / PULSE_RISE;
+  dt -= PULSE_RISE;
+  if (dt < p.length) return p.amplitude;
+  return p.amplitude * exp(-(dt - p.length) / PULSE_TAU);
+}
+
+
+//
+// Format a vehicle the same way as the CarCounter
+//
+static void
+formatLog(char *line, size_t size, uint64_t ms, double mph, bool isUp,
+	  unsigned int nAxles, double length, unsigned int fhwaClass)
+{
+  time_t now = ms / 1000;
+  struct tm *lt = localtime(&now);
+  snprintf(line, size, "%ld  %4d/%02d/%02d %02d:%02d:%02d %6.1f MPH %4shill. Axles=%d Length=%5.1f ft. Class=%d\n", now,
+	   lt->tm_year + 1900, lt->tm_mon + 1, lt->tm_mday, lt->tm_hour, lt->tm_min, lt->tm_sec,
+	   mph, (isUp) ? "Up" : "Down", nAxles, length, fhwaClass);
+}
+
+
+//
+// Glitches in the log, for the Analyzer to clean up
+//
+enum {NO_GLITCH, DUPLICATE, MISMATCHED, LATE, VERY_LATE};
+
+static char         gLate[128];
+// Vehicles still to be logged before the late one
+static unsigned int gLateCount = 0;
+
+
+//
+// Generate the vehicles and the pulses they create on the hoses
+//
+static void
+generateTraffic(FILE *truth, FILE *logFp)
+{
+  if (truth != NULL) {
+    fprintf(truth, "# stamp(ms) direction MPH axles class spacing(ft)...\n");
+  }
+
+  // Vehicles in the same direction are at least gHeadway secs apart
+  double laneFree[2] = {0, 0};
+
+  double t = 0;
+  while (1) {
+    // Poisson arrivals
+    t += -log(1 - uniform()) * 3600e3 / gVehicles;
+
+    bool isUp = uniform() < gUpRatio;
+    if (t < laneFree[isUp]) t = laneFree[isUp];
+    if (t >= gDuration * 1000 - PULSE_LEN * 10) break;
+
+    double mph = gaussian(gSpeed, gSpeedDev);
+    if (mph < 5)  mph = 5;
+    if (mph > 45) mph = 45;
+
+    const struct profile_s *prof = &profiles[0];
+    if (uniform() < gTrucks) {
+      prof = &profiles[2 + (unsigned int) (uniform() * 3)];
+    } else if (uniform() < 0.3) {
+      prof = &profiles[1];
+    }
+
+    double spacing[4];
+    double axle = t;
+    for (unsigned int i = 0; i < prof->nAxles; i++) {
+      if (i > 0) {
+	spacing[i-1] = uniform(prof->minSpacing[i-1], prof->maxSpacing[i-1]);
+	axle += spacing[i-1] / (FT_PER_MS_MPH * mph);
+      }
+
+      // Uphill vehicles cross the hose on channel 1 first
+      double delay = HOSE_SPACING / (FT_PER_MS_MPH * mph);
+      double tire  = TIRE_LENGTH / (FT_PER_MS_MPH * mph);
+      double amp   = uniform(0x110, 0x180) * ((i == 0 || prof->nAxles == 2) ? 1.0 : 1.2);
+      addPulse(axle,         tire, amp * uniform(0.95, 1.05), (isUp) ? 1 : 0);
+      addPulse(axle + delay, tire, amp * uniform(0.95, 1.05), (isUp) ? 0 : 1);
+    }
+    laneFree[isUp] = axle + gHeadway * 1000;
+
+    if (truth != NULL) {
+      fprintf(truth, "%llu %s %.1f %u %u", (unsigned long long) (gStart + (uint64_t) t),
+	      (isUp) ? "Up" : "Down", mph, prof->nAxles, prof->fhwaClass);
+      for (unsigned int i = 0; i + 1 < prof->nAxles; i++) fprintf(truth, " %.1f", spacing[i]);
+      fprintf(truth, "\n");
+    }
+
+    if (logFp != NULL) {
+      uint64_t ms = gStart + (uint64_t) t;
+      double length = 0;
+      for (unsigned int i = 0; i + 1 < prof->nAxles; i++) length += spacing[i];
+
+      char line[128];
+      formatLog(line, sizeof(line), ms, mph, isUp, prof->nAxles, length, prof->fhwaClass);
+
+      unsigned int glitch = NO_GLITCH;
+      if (gGlitch > 0 && uniform() < gGlitch) glitch = DUPLICATE + (unsigned int) (uniform() * 4);
+
+      if ((glitch == LATE || glitch == VERY_LATE) && gLateCount == 0) {
+	// Logged after the next vehicle (put back in order) or the one after (dropped)
+	strcpy(gLate, line);
+	gLateCount = (glitch == LATE) ? 1 : 2;
+      } else {
+	fputs(line, logFp);
+
+	// A stray axle a second later, with about the same speed or a very different one
+	if (glitch == DUPLICATE || glitch == MISMATCHED) {
+	  formatLog(line, sizeof(line), ms + 1000, mph + ((glitch == DUPLICATE) ? 0.5 : 15), isUp,
+		    1, 0.0, 0);
+	  fputs(line, logFp);
+	}
+
+	if (gLateCount > 0 && --gLateCount == 0) fputs(gLate, logFp);
+      }
+    }
+  }
+  if (logFp != NULL && gLateCount > 0) fputs(gLate, logFp);
+
+  // Vehicles in both directions are interleaved
+  qsort(gPulses, gNPulses, sizeof(pulse_t), cmpPulse);
+}
+
+
+//
+// Generate the raw samples
+//
+static void
+generateSamples(FILE *fp)
+{
+  double base[2] = {0x200, 0x1e0};
+
+  fprintf(fp, "%04x %04x %08llx\n", (unsigned int) base[0], (unsigned int) base[1],
+	  (unsigned long long) gStart);
+
+  // Pulses that have started and are not yet negligible
+  unsigned int first = 0;
+  unsigned int last  = 0;
+
+  uint64_t nSamples = (uint64_t) (gDuration * gRate);
+  for (uint64_t i = 0; i < nSamples; i++) {
+    double t = i * 1000.0 / gRate;
+
+    while (first < gNPulses && gPulses[first].start + PULSE_LEN < t) first++;
+    while (last < gNPulses && gPulses[last].start <= t) last++;
+
+    double drift = gDrift * sin(2 * M_PI * t / (gDriftPer * 1000));
+
+    unsigned int sample[2];
+    for (unsigned int chan = 0; chan < 2; chan++) {
+      double pressure = base[chan] + drift + gaussian(0, gNoise);
+      // A parked car or a kinked hose
+      if (chan == 0 && gDuration * 500 <= t && t < gDuration * 500 + gStuck * 1000) pressure += STUCK_PRESSURE;
+      for (unsigned int p = first; p < last; p++) {
+	if (gPulses[p].chan == chan) pressure += pulse(gPulses[p], t);
+      }
+
+      if (pressure < 0)     pressure = 0;
+      if (pressure > 0xfff) pressure = 0xfff;
+      sample[chan] = (unsigned int) pressure;
+
+      // Glitches on the serial interface
+      if (uniform() < gBad) {
+	sample[chan] = (uniform() < 0.5) ? (unsigned int) uniform(0, 0x180) : 0xffff;
+      }
+    }
+
+    fprintf(fp, "%04x %04x %08llx\n", sample[0], sample[1], (unsigned long long) (gStart + (uint64_t) t));
+  }
+}
+
+
+void
+usage(const char* cmd)
+{
+  fprintf(stderr, "Usage: %s [options] [-o fname] [-g fname]\n", cmd);
+  fprintf(stderr, "\nOptions:\n");
+  fprintf(stderr, "    -o fname     Write the raw samples in fname (default: stdout)\n");
+  fprintf(stderr, "    -g fname     Write the list of generated vehicles in fname\n");
+  fprintf(stderr, "    -L           Write the log the CarCounter would produce instead of the raw samples\n");
+  fprintf(stderr, "    -T n         Start time, in secs since the epoch\n");
+  fprintf(stderr, "    -x n         Fraction of vehicles logged twice or late in the log (default: %g)\n", gGlitch);
+  fprintf(stderr, "    -s n         Random seed (default: %u)\n", gSeed);
+  fprintf(stderr, "    -t n         Duration, in secs (default: %.0f)\n", gDuration);
+  fprintf(stderr, "    -f n         Samples per sec (default: %.0f)\n", gRate);
+  fprintf(stderr, "    -v n         Vehicles per hour (default: %.0f)\n", gVehicles);
+  fprintf(stderr, "    -m n         Average speed, in MPH (default: %.0f)\n", gSpeed);
+  fprintf(stderr, "    -M n         Standard deviation of the speed, in MPH (default: %.0f)\n", gSpeedDev);
+  fprintf(stderr, "    -u n         Fraction of vehicles going uphill (default: %.2f)\n", gUpRatio);
+  fprintf(stderr, "    -k n         Fraction of trucks (default: %.2f)\n", gTrucks);
+  fprintf(stderr, "    -n n         Noise, in ADC counts (default: %.0f)\n", gNoise);
+  fprintf(stderr, "    -d n         Baseline drift, in ADC counts (default: %.0f)\n", gDrift);
+  fprintf(stderr, "    -b n         Probability of a bad sample (default: %g)\n", gBad);
+  fprintf(stderr, "    -H n         Minimum time between the last axle of a vehicle and the next one in the same direction, in secs (default: %.0f)\n", gHeadway);
+  fprintf(stderr, "    -j n         Hose 0 is stuck high for n secs, halfway through (default: %.0f)\n", gStuck);
+  exit(-1);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  FILE *fp    = stdout;
+  FILE *truth = NULL;
+
+  int optc;
+  while ((optc = getopt(argc, argv, "b:d:f:g:hH:j:k:Lm:M:n:o:s:t:T:u:v:x:")) != -1) {
+    switch (optc) {
+    case 'b': gBad      = atof(optarg); break;
+    case 'd': gDrift    = atof(optarg); break;
+    case 'f': gRate     = atof(optarg); break;
+    case 'H': gHeadway  = atof(optarg); break;
+    case 'j': gStuck    = atof(optarg); break;
+    case 'k': gTrucks   = atof(optarg); break;
+    case 'm': gSpeed    = atof(optarg); break;
+    case 'M': gSpeedDev = atof(optarg); break;
+    case 'n': gNoise    = atof(optarg); break;
+    case 's': gSeed     = atoi(optarg); break;
+    case 't': gDuration = atof(optarg); break;
+    case 'u': gUpRatio  = atof(optarg); break;
+    case 'v': gVehicles = atof(optarg); break;
+    case 'x': gGlitch   = atof(optarg); break;
+    case 'L': gIsLog    = true; break;
+    case 'T': gStart    = atoll(optarg) * 1000; break;
+
+    case 'o':
+      fp = fopen(optarg, "w");
+      if (fp == NULL) {
+	fprintf(stderr, "ERROR: Cannot open \"%s\" for writing: %s\n", optarg, strerror(errno));
+	exit(-1);
+      }
+      break;
+
+    case 'g':
+      truth = fopen(optarg, "w");
+      if (truth == NULL) {
+	fprintf(stderr, "ERROR: Cannot open \"%s\" for writing: %s\n", optarg, strerror(errno));
+	exit(-1);
+      }
+      break;
+
+    case 'h':
+    case '?':
+      usage(argv[0]);
+    }
+  }
+
+  gRng = 0x9e3779b97f4a7c15ULL * (gSeed + 1);
+
+  generateTraffic(truth, (gIsLog) ? fp : NULL);
+  if (!gIsLog) generateSamples(fp);
+
+  if (truth != NULL) fclose(truth);
+  fclose(fp);
+  free(gPulses);
+
+  return 0;
+}
@@ -0,0 +1,316 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "logread.h"
+
+
+// Ring of buffers between the decompression thread and the parser
+#define LOG_NBUFS     4
+#define LOG_BUFSIZE   (64 * 1024)
+
+typedef struct pipeline_s {
+  const char     *fname;
+
+  // Decompressor
+  gzFile          gz;
+  FILE           *zst;
+  pid_t           child;   // 'zstd -dc' when not linked with libzstd
+#ifdef HAVE_ZSTD
+  ZSTD_DStream   *zds;
+  char            inBuf[LOG_BUFSIZE];
+  ZSTD_inBuffer   in;
+  size_t          zret;
+#endif
+
+  char            bufs[LOG_NBUFS][LOG_BUFSIZE];
+  // Bytes in each full buffer: 0 at the end of the file, -1 on error
+  ssize_t         len[LOG_NBUFS];
+  bool            isFull[LOG_NBUFS];
+  bool            isClosing;
+
+  // Where the parser is reading
+  unsigned int    head;
+  size_t          pos;
+  bool            isEof;
+
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  fullCond;
+  pthread_cond_t  freeCond;
+} pipeline_t;
+
+
+static bool
+hasSuffix(const char *fname, const char *suffix)
+{
+  size_t n = strlen(fname);
+  size_t m = strlen(suffix);
+  return n >= m && strcmp(fname + n - m, suffix) == 0;
+}
+
+
+//
+// Decompress up to 'size' bytes. Returns 0 at the end of the file and -1 on error.
+//
+static ssize_t
+decompress(pipeline_t *p, char *buf, size_t size)
+{
+  if (p->gz != NULL) {
+    int n = gzread(p->gz, buf, size);
+    // A truncated file looks like the end of the file, with an error
+    int err = Z_OK;
+    const char *msg = (n <= 0) ? gzerror(p->gz, &err) : NULL;
+    if (err != Z_OK) {
+      fprintf(stderr, "ERROR: Cannot decompress \"%s\": %s\n", p->fname, msg);
+      return -1;
+    }
+    return n;
+  }
+
+#ifdef HAVE_ZSTD
+  if (p->zds != NULL) {
+    ZSTD_outBuffer out = {buf, size, 0};
+    while (out.pos == 0) {
+      if (p->in.pos == p->in.size) {
+	p->in.size = fread(p->inBuf, 1, sizeof(p->inBuf), p->zst);
+	p->in.pos  = 0;
+	if (p->in.size == 0) {
+	  if (p->zret == 0 && !ferror(p->zst)) return 0;
+	  fprintf(stderr, "ERROR: \"%s\" is truncated\n", p->fname);
+	  return -1;
+	}
+      }
+      p->zret = ZSTD_decompressStream(p->zds, &out, &p->in);
+      if (ZSTD_isError(p->zret)) {
+	fprintf(stderr, "ERROR: Cannot decompress \"%s\": %s\n", p->fname, ZSTD_getErrorName(p->zret));
+	return -1;
+      }
+    }
+    return out.pos;
+  }
+#endif
+
+  size_t n = fread(buf, 1, size, p->zst);
+  if (n > 0) return n;
+  if (ferror(p->zst)) {
+    fprintf(stderr, "ERROR: Cannot decompress \"%s\": %s\n", p->fname, strerror(errno));
+    return -1;
+  }
+
+  // zstd has already explained why it failed
+  int status;
+  waitpid(p->child, &status, 0);
+  p->child = 0;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+  return 0;
+}
+
+
+static void *
+decompressor(void *cookie)
+{
+  pipeline_t *p = (pipeline_t *) cookie;
+
+  unsigned int slot = 0;
+  while (1) {
+    pthread_mutex_lock(&p->lock);
+    while (p->isFull[slot] && !p->isClosing) pthread_cond_wait(&p->freeCond, &p->lock);
+    bool isClosing = p->isClosing;
+    pthread_mutex_unlock(&p->lock);
+    if (isClosing) break;
+
+    ssize_t n = decompress(p, p->bufs[slot], LOG_BUFSIZE);
+
+    pthread_mutex_lock(&p->lock);
+    p->len[slot]    = n;
+    p->isFull[slot] = true;
+    pthread_cond_signal(&p->fullCond);
+    pthread_mutex_unlock(&p->lock);
+
+    if (n <= 0) break;
+    slot = (slot + 1) % LOG_NBUFS;
+  }
+
+  return NULL;
+}
+
+
+static ssize_t
+logRead(void *cookie, char *buf, size_t size)
+{
+  pipeline_t *p = (pipeline_t *) cookie;
+
+  size_t done = 0;
+  while (done < size && !p->isEof) {
+    pthread_mutex_lock(&p->lock);
+    while (!p->isFull[p->head]) pthread_cond_wait(&p->fullCond, &p->lock);
+    ssize_t len = p->len[p->head];
+    pthread_mutex_unlock(&p->lock);
+
+    // Errors are reported once what was decompressed before them has been read
+    if (len < 0) return (done > 0) ? (ssize_t) done : -1;
+    if (len == 0) {
+      p->isEof = true;
+      break;
+    }
+
+    size_t n = len - p->pos;
+    if (n > size - done) n = size - done;
+    memcpy(buf + done, p->bufs[p->head] + p->pos, n);
+    p->pos += n;
+    done   += n;
+
+    if (p->pos == (size_t) len) {
+      // Give the buffer back to the decompressor
+      pthread_mutex_lock(&p->lock);
+      p->isFull[p->head] = false;
+      pthread_cond_signal(&p->freeCond);
+      pthread_mutex_unlock(&p->lock);
+
+      p->head = (p->head + 1) % LOG_NBUFS;
+      p->pos  = 0;
+    }
+  }
+
+  return done;
+}
+
+
+static int
+logClose(void *cookie)
+{
+  pipeline_t *p = (pipeline_t *) cookie;
+
+  pthread_mutex_lock(&p->lock);
+  p->isClosing = true;
+  pthread_cond_signal(&p->freeCond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+
+  if (p->gz != NULL) gzclose(p->gz);
+#ifdef HAVE_ZSTD
+  if (p->zds != NULL) ZSTD_freeDStream(p->zds);
+#endif
+  if (p->zst != NULL) fclose(p->zst);
+  if (p->child > 0) {
+    kill(p->child, SIGTERM);
+    waitpid(p->child, NULL, 0);
+  }
+
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->fullCond);
+  pthread_cond_destroy(&p->freeCond);
+  free(p);
+
+  return 0;
+}
+
+
+#ifndef HAVE_ZSTD
+//
+// Run 'zstd -dc fname', reading its output
+//
+static FILE *
+spawnZstd(const char *fname, pid_t &child)
+{
+  // Check the file is there, so a missing log is reported as such
+  if (access(fname, R_OK) < 0) return NULL;
+
+  int fds[2];
+  if (pipe(fds) < 0) return NULL;
+
+  child = fork();
+  if (child < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+  if (child == 0) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execlp("zstd", "zstd", "-dcq", "--", fname, (char *) NULL);
+    fprintf(stderr, "ERROR: Cannot run zstd: %s\n", strerror(errno));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  return fdopen(fds[0], "r");
+}
+#endif
+
+
+FILE *
+logOpen(const char *fname)
+{
+  bool isGz  = hasSuffix(fname, ".gz");
+  bool isZst = hasSuffix(fname, ".zst");
+  if (!isGz && !isZst) return fopen(fname, "r");
+
+  pipeline_t *p = (pipeline_t *) calloc(1, sizeof(pipeline_t));
+  if (p == NULL) return NULL;
+  p->fname = fname;
+
+  if (isGz) {
+    p->gz = gzopen(fname, "rb");
+    if (p->gz != NULL) gzbuffer(p->gz, LOG_BUFSIZE);
+  } else {
+#ifdef HAVE_ZSTD
+    p->zst = fopen(fname, "r");
+    if (p->zst != NULL) {
+      p->zds = ZSTD_createDStream();
+      ZSTD_initDStream(p->zds);
+    }
+#else
+    p->zst = spawnZstd(fname, p->child);
+#endif
+  }
+
+  if (p->gz == NULL && p->zst == NULL) {
+    int err = errno;
+    free(p);
+    errno = err;
+    return NULL;
+  }
+
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->fullCond, NULL);
+  pthread_cond_init(&p->freeCond, NULL);
+
+  cookie_io_functions_t funcs = {logRead, NULL, NULL, logClose};
+  FILE *fp = fopencookie(p, "r", funcs);
+  if (fp == NULL || pthread_create(&p->thread, NULL, decompressor, p) != 0) {
+    fprintf(stderr, "ERROR: Cannot start decompressing \"%s\"\n", fname);
+    exit(-1);
+  }
+
+  return fp;
+}
@@ -0,0 +1,33 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __LOGREAD_H__
+#define __LOGREAD_H__
+
+#include <stdio.h>
+
+//
+// Open a log file for reading, decompressing it on the fly if its name ends
+// in ".gz" or ".zst".
+//
+// Compressed logs are decompressed by a separate thread into a small ring of
+// buffers, so decompression overlaps with parsing and nothing is written to
+// disk. The returned stream is read with the usual stdio functions and
+// closed with fclose().
+//
+FILE *logOpen(const char *fname);
+
+#endif
@@ -16,6 +16,7 @@
 
 #include <error.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -25,202 +26,58 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "capture.h"
+#include "classify.h"
+#include "detector.h"
+#include "rt.h"
+
 
-unsigned int gDebug = 0;
 bool         gIsRead = false;
 FILE        *gFp = NULL;
 
-static struct channel_s {
-  double   average;
-  bool     isIdle;
-  bool     isChanging;
-  uint32_t changeCount;
-  uint64_t detectTime;
-  bool     hasEvent;
-} channelData[2] = {
-  {0x200, true, 0, 0, false},
-  {0x200, true, 0, 0, false}
-};
-
-uint64_t frontWheelStamp = 0;
-
+// Set when asked to terminate
+volatile sig_atomic_t gStop = 0;
 
 void
-analyzeChannel(unsigned int chan,
-	       uint16_t     pressure,
-	       uint64_t     stamp)
+onStop(int)
 {
-  // Reject obviously bad samples
-  if (pressure < 0x0180 || 0x1000 < pressure) return;
-
-  char HxL = 'x';
-  
-  if (pressure >= channelData[chan].average + 0x0c0) {
-
-    // High pressure detected
-    HxL = 'H';
-    
-    if (channelData[chan].isIdle) {
-      // Are we in the middle of a transition?
-      if (channelData[chan].isChanging) {
-	// Have we reached the end of the transition?
-	// Must see 20 consecutive high-pressure samples
-	if (channelData[chan].changeCount++ >= 20) {
-
-	  channelData[chan].isIdle      = false;
-	  channelData[chan].isChanging  = false;
-	  channelData[chan].changeCount = 0;
-	  channelData[chan].detectTime = stamp;
-	  channelData[chan].hasEvent    = true;
-
-	  if (gDebug > 0) {
-	    unsigned int otherChan = ((chan + 1) & 0x1);
-	    if (channelData[otherChan].hasEvent) {
-	      printf("DTCT %d %04x > %04x at %08llx with pending event on %d %lld ms ago\n",
-		     chan, pressure, (unsigned int) channelData[chan].average, stamp,
-		     otherChan, stamp - channelData[otherChan].detectTime);
-	    } else {
-	      printf("DTCT %d %04x > %04x at %08llx with no event on %d\n",
-		     chan, pressure, (unsigned int) channelData[chan].average, stamp, otherChan);
-	    }
-	  }
-	}
-	
-      } else {
-	// We started changing
-	channelData[chan].isChanging = true;
-	channelData[chan].changeCount = 1;
-      }
-    } else {
-      // A single high-pressure sample cancels a low-pressure transition
-      channelData[chan].isChanging  = false;
-      channelData[chan].changeCount = 0;
-    }
-
-  } else if (pressure <= channelData[chan].average + 0x020) {
-
-    // Low ressure detected
-    HxL = 'L';
-    
-    if (not channelData[chan].isIdle) {
-      // Are we in the middle of a transition?
-      if (channelData[chan].isChanging) {
-	// Must see > 20 consecutive low-pressure samples
-	if (channelData[chan].changeCount++ >= 60) {
-
-	  channelData[chan].isIdle      = true;
-	  channelData[chan].isChanging  = false;
-	  channelData[chan].changeCount = 0;
-	  
-	  if (gDebug > 0) {
-	    printf("IDLE %d %04x < %04x at %08llx\n",
-		   chan, pressure, (unsigned int) channelData[chan].average, stamp);
-	  }
-	}
-	
-      } else {
-	// We started changing
-	channelData[chan].isChanging = true;
-	channelData[chan].changeCount = 1;
-      }
-    } else {
-      // A single low-pressure sample cancels a high-pressure transition
-      channelData[chan].isChanging  = false;
-      channelData[chan].changeCount = 0;
-    }
-  }
-  
-  if (gDebug > 1) {
-    printf("%04x %04x %c %08llx %c%s%3d    ", pressure, (unsigned int) channelData[chan].average, HxL, stamp,
-	   channelData[chan].isIdle ? 'L' : 'H',
-	   channelData[chan].isChanging ? "->" : "  ",
-	   channelData[chan].changeCount);
-  }
-  
-
-  if (channelData[chan].isIdle && !channelData[chan].isChanging) {
-    // Update the running average
-    #define AVERAGE_WIN 250
-    channelData[chan].average = ((channelData[chan].average * (double) (AVERAGE_WIN-1)) + pressure) / (double) AVERAGE_WIN;
-  }
+  gStop = 1;
 }
 
-  
 void
-analyzeSample(uint16_t chan0,
-	      uint16_t chan1,
-	      uint64_t stamp)
+reportVehicle(const vehicle_t &v)
 {
-  if (gFp != NULL && !gIsRead) {
-    fprintf(gFp, "%04x %04x %08llx\n", chan0, chan1, stamp);
-  }
-  
-  analyzeChannel(0, chan0, stamp);
-  analyzeChannel(1, chan1, stamp);
-  if (gDebug > 1) {
-    printf("\n");
-  }
-
-  //  printf("%d %f\n", chan0, channelData[0].average);
-  //  if (channelData[0].average < 425) exit(9);
-
-  // Do we have an event recorded on both channels?
-  if (!channelData[0].hasEvent || !channelData[1].hasEvent) return;
-
-  // Which one occured first?
-  long long int ms = channelData[0].detectTime - channelData[1].detectTime;
-
-  bool isUp = true;
-  if (ms < 0) {
-    isUp = false;
-    ms = -ms;
-  }
-
-  // Reject detections that are way to slow
-  if (ms > 2000) {
-    // But save the latest event to recover
-    if (isUp) channelData[1].hasEvent = false;
-    else channelData[0].hasEvent = false;
-    return;
-  }
-
-  // If it takes 'ms' to cover 12 inches, what is the speed?
-  double mph = ((double) 681.8) / ms;
-
-  // Marked these event has handled
-  channelData[0].hasEvent = false;
-  channelData[1].hasEvent = false;
-
-  time_t now = stamp/1000;
+  time_t now = v.stamp/1000;
   struct tm *lt = localtime(&now);
   printf("%ld  %4d/%02d/%02d %02d:%02d:%02d ", now,
 	 lt->tm_year + 1900, lt->tm_mon + 1, lt->tm_mday, lt->tm_hour, lt->tm_min, lt->tm_sec);
   
   // Reject if the speed is too high
-  if (0 && mph > 60) {
+  if (0 && v.mph > 60) {
     printf("                     ");
   } else {
-    printf("%6.1f MPH %4shill.", mph, (isUp) ? "Up" : "Down");
+    printf("%6.1f MPH %4shill.", v.mph, (v.isUp) ? "Up" : "Down");
   };
 
-  // Measure wheel base (It does not matter which hose we use)
-  stamp = channelData[1].detectTime;
-  
-  ms = stamp - frontWheelStamp;
-  if (ms < 0) ms = -ms;
-  double feet = 0.00147 * ms * mph;
-
-  frontWheelStamp = stamp;
-
-  // Reject if the wheelbase is obviously too long
-  if (feet < 25) {
-    printf(" Wheel base =%5.1f ft.", feet);
-  }
+  printf(" Axles=%d Length=%5.1f ft. Class=%d", v.nAxles, v.length, v.fhwaClass);
 
   printf("\n");
   fflush(stdout);
 }
 
+//
+// A hose held down by a parked car or kinked stops counting for a while
+//
+void
+reportStuck()
+{
+  const detectorStats_t &stats = detectorStats();
+  if (stats.recoveries[0] + stats.recoveries[1] == 0) return;
+
+  fprintf(stderr, "WARNING: Recovered from a stuck hose %llu times on hose 0, %llu times on hose 1\n",
+	  stats.recoveries[0], stats.recoveries[1]);
+}
+
 
 //
 // GPIO operations
@@ -382,28 +239,78 @@ uint16_t readADC(int channel)
 }
 
 
+//
+// One sample on both channels, for the jitter self-test
+//
+void
+sampleADC()
+{
+  readADC(0);
+  readADC(1);
+}
+
+
 int
 main(int argc, char* argv[])
 {
-  const char* fname = NULL;
+  const char*  fname = NULL;
+  bool         isRealTime = false;
+  rtConfig_t   rtConfig = {80, -1, 1000};
+  unsigned int nJitter = 0;
 
   int optc;
-  while ((optc = getopt(argc, argv, "D:hr:w:")) != -1) {
+  while ((optc = getopt(argc, argv, "c:D:hJ:p:P:r:Rs:w:")) != -1) {
     switch (optc) {
+    case 'c':
+      rtConfig.cpu = atoi(optarg);
+      break;
+
     case 'D':
       gDebug = atoi(optarg);
       break;
       
     case 'h':
     case '?':
-      fprintf(stderr, "Usage: %s [-D n] [-r fname | -w fname]\n", argv[0]);
+      fprintf(stderr, "Usage: %s [-D n] [-s site] [-R [-p n] [-c n] [-P us]] [-J n] [-r fname | -w fname]\n", argv[0]);
+      fprintf(stderr, "\nOptions:\n");
+      fprintf(stderr, "    -R           Sample in real-time mode\n");
+      fprintf(stderr, "    -p n         SCHED_FIFO priority in real-time mode (default: %d)\n", rtConfig.priority);
+      fprintf(stderr, "    -c n         CPU to sample on in real-time mode (default: the last one)\n");
+      fprintf(stderr, "    -P us        Sampling period in real-time mode, 0 for as fast as possible (default: %u)\n", rtConfig.periodUs);
+      fprintf(stderr, "    -J n         Report the jitter over n samples before and after enabling real-time mode, then exit\n");
+      fprintf(stderr, "\nSites:\n");
+      detectorList(stderr);
       exit(1);
+
+    case 'J':
+      nJitter = atoi(optarg);
+      break;
+
+    case 'p':
+      rtConfig.priority = atoi(optarg);
+      break;
+
+    case 'P':
+      rtConfig.periodUs = atoi(optarg);
+      break;
+
+    case 'R':
+      isRealTime = true;
+      break;
       
     case 'r':
       gIsRead = true;
       fname = optarg;
       break;
       
+    case 's':
+      if (!detectorSelect(optarg)) {
+	fprintf(stderr, "ERROR: Unknown site \"%s\". Sites are:\n", optarg);
+	detectorList(stderr);
+	exit(1);
+      }
+      break;
+
     case 'w':
       gIsRead = false;
       fname = optarg;
@@ -411,8 +318,20 @@ main(int argc, char* argv[])
     }
   }
 
-  if (fname != NULL) {
-    gFp = fopen(fname, (gIsRead) ? "r" : "w");
+  // The jitter self-test exits before anything would be captured
+  if (nJitter > 0 && fname != NULL && !gIsRead) {
+    fprintf(stderr, "ERROR: -J cannot be used with -w\n");
+    return -1;
+  }
+
+  // Replaying a capture does not sample
+  if ((isRealTime || nJitter > 0) && gIsRead) {
+    fprintf(stderr, "ERROR: -R and -J cannot be used with -r\n");
+    return -1;
+  }
+
+  if (fname != NULL && gIsRead) {
+    gFp = fopen(fname, "r");
     if (gFp == NULL) {
       fprintf(stderr, "ERROR: Cannot open \"%s\": ", fname);
       perror(NULL);
@@ -433,18 +352,21 @@ main(int argc, char* argv[])
   fprintf(fp, "%d\n", pid);
   fclose(fp);
 
+  classifyInit(reportVehicle);
+
   uint64_t       ms;
   uint32_t       chan0;
   uint32_t       chan1;
   
   if (gFp != NULL && gIsRead) {
     fscanf(gFp, "%x%x%llx", &chan0, &chan1, &ms);
-    channelData[0].average = chan0;
-    channelData[1].average = chan1;
+    detectorInit(chan0, chan1);
     while (fscanf(gFp, "%x%x%llx", &chan0, &chan1, &ms) == 3) {
       if (ms < 0x10000000000) ms += 0x16100000000;
       analyzeSample(chan0, chan1, ms);
     }
+    classifyFlush();
+    reportStuck();
 
     fclose(gFp);
     return 0;
@@ -456,20 +378,56 @@ main(int argc, char* argv[])
   DI  = gpioOpen(138, 'w');
   if (CSn <= 0 || CLK <= 0 || DO <= 0 || DI <= 0) return -1;
 
+  // Raw samples are written by a separate thread so a slow SD card does not stall the sampling
+  bool isCapturing = (fname != NULL);
+  if (isCapturing && !captureOpen(fname)) return -1;
+
+  // Stop cleanly so the captured samples are all written out
+  signal(SIGINT,  onStop);
+  signal(SIGTERM, onStop);
+
   initADC();
-  channelData[0].average = readADC(0);
-  channelData[1].average = readADC(1);
+  chan0 = readADC(0);
+  chan1 = readADC(1);
+  detectorInit(chan0, chan1);
+
+  if (nJitter > 0) {
+    rtJitter("Normal mode   ", nJitter, sampleADC);
+    if (!rtEnable(rtConfig)) return -1;
+    rtJitter("Real-time mode", nJitter, sampleADC, true);
+    return 0;
+  }
+
+  // Nothing may be allocated from here on in real-time mode
+  if (isRealTime && !rtEnable(rtConfig)) return -1;
 
   struct timeval tv;
-  while (1) {
+  while (!gStop) {
+    if (isRealTime) rtPace();
+
     chan0 = readADC(0);
     chan1 = readADC(1);
 
     gettimeofday(&tv, NULL);
     ms = (((uint64_t) tv.tv_sec) * 1000) + (tv.tv_usec / 1000);
     
+    if (isCapturing) captureSample(chan0, chan1, ms);
     analyzeSample(chan0, chan1, ms);
   }
+
+  // Don't lose the last vehicle
+  classifyFlush();
+  reportStuck();
+
+  if (isCapturing) {
+    captureClose();
+
+    const captureStats_t &stats = captureStats();
+    fprintf(stderr, "Capture: %llu bytes in %.1f s (%.0f KB/s), %llu writes, worst write %llu us, %llu buffer-full waits\n",
+	    (unsigned long long) stats.bytes, stats.elapsed, stats.bytes / stats.elapsed / 1024,
+	    (unsigned long long) stats.writes, (unsigned long long) stats.worstWrite,
+	    (unsigned long long) stats.fullWaits);
+  }
   
   return 0;
 }
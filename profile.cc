@@ -0,0 +1,185 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.h"
+
+
+// Weight of a new day in the running mean and variance
+#define PROFILE_ALPHA 0.1
+
+// Days needed in a profile before anything can be unusual
+#define PROFILE_MIN_DAYS 3
+
+// Smallest standard deviation used for speeds, so a very regular interval
+// is not flagged for a 1 MPH difference. Counts are at least as variable
+// as a Poisson process with the same mean.
+#define PROFILE_MIN_DEV 1.0
+
+#define PROFILE_MAGIC   0x50575743   // "CWWP"
+#define PROFILE_VERSION 2
+
+
+typedef struct stat_s {
+  float mean;
+  float var;
+} stat_t;
+
+//
+// File format, in native byte order: the header followed by one profile_t per day of the week
+//
+typedef struct header_s {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t nBins;
+} header_t;
+
+typedef struct bins_s {
+  uint32_t nDays;
+  uint32_t reserved;
+  stat_t   up[PROFILE_BINS];
+  stat_t   dn[PROFILE_BINS];
+  stat_t   speed[PROFILE_BINS];
+} bins_t;
+
+typedef struct profile_s {
+  int64_t  lastDay;
+  bins_t   bins;
+  // Before the last day was added, so it can be replaced
+  bins_t   prev;
+} profile_t;
+
+static profile_t gProfiles[7];
+
+
+bool
+profileLoad(const char *fname)
+{
+  memset(gProfiles, 0, sizeof(gProfiles));
+
+  FILE *fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    if (errno == ENOENT) return true;
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for reading: %s\n", fname, strerror(errno));
+    return false;
+  }
+
+  header_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != PROFILE_MAGIC
+      || hdr.version != PROFILE_VERSION || hdr.nBins != PROFILE_BINS
+      || fread(gProfiles, sizeof(gProfiles), 1, fp) != 1) {
+    fprintf(stderr, "ERROR: \"%s\" is not a weekday profile file\n", fname);
+    memset(gProfiles, 0, sizeof(gProfiles));
+    fclose(fp);
+    return false;
+  }
+
+  fclose(fp);
+  return true;
+}
+
+
+bool
+profileSave(const char *fname)
+{
+  FILE *fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for writing: %s\n", fname, strerror(errno));
+    return false;
+  }
+
+  header_t hdr = {PROFILE_MAGIC, PROFILE_VERSION, PROFILE_BINS};
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fwrite(gProfiles, sizeof(gProfiles), 1, fp) != 1) {
+    fprintf(stderr, "ERROR: Cannot write \"%s\": %s\n", fname, strerror(errno));
+    fclose(fp);
+    return false;
+  }
+
+  return fclose(fp) == 0;
+}
+
+
+static void
+checkBin(unsigned int bin, const char *what, const stat_t &stat, double val, double zMax, bool isCount)
+{
+  double dev = sqrt(stat.var);
+  double minDev = (isCount) ? sqrt(stat.mean) : 0;
+  if (minDev < PROFILE_MIN_DEV) minDev = PROFILE_MIN_DEV;
+  if (dev < minDev) dev = minDev;
+
+  double z = (val - stat.mean) / dev;
+  if (-zMax <= z && z <= zMax) return;
+
+  printf("Unusual [%02d:%02d] %-5s %5.1f, expected %5.1f +/- %4.1f (z = %+.1f)\n",
+	 bin / 4, 15 * (bin % 4), what, val, stat.mean, dev, z);
+}
+
+
+//
+// Exponentially weighted mean and variance
+//
+static void
+update(stat_t &stat, double val, bool isFirst)
+{
+  if (isFirst) {
+    stat.mean = val;
+    stat.var  = 0;
+    return;
+  }
+
+  double diff = val - stat.mean;
+  double incr = PROFILE_ALPHA * diff;
+  stat.mean += incr;
+  stat.var   = (1 - PROFILE_ALPHA) * (stat.var + diff * incr);
+}
+
+
+void
+profileDay(unsigned int wday, time_t startOfDay, const profileDay_t &day, double zMax)
+{
+  profile_t &prof = gProfiles[wday % 7];
+
+  // The same day again, maybe with more of its events: it replaces the earlier one
+  if (prof.bins.nDays > 0 && startOfDay == prof.lastDay) prof.bins = prof.prev;
+
+  bins_t &bins = prof.bins;
+  if (bins.nDays >= PROFILE_MIN_DAYS) {
+    for (unsigned int i = 0; i < PROFILE_BINS; i++) {
+      checkBin(i, "Up",  bins.up[i], day.up[i], zMax, true);
+      checkBin(i, "Dn",  bins.dn[i], day.dn[i], zMax, true);
+      // No speed is not unusual, nor can it make a speed unusual
+      if (day.speed[i] > 0 && bins.speed[i].mean > 0) checkBin(i, "MPH", bins.speed[i], day.speed[i], zMax, false);
+    }
+  }
+
+  // Older than the days already in the profile?
+  if (bins.nDays > 0 && startOfDay < prof.lastDay) return;
+
+  prof.prev = bins;
+  bool isFirst = (bins.nDays == 0);
+  for (unsigned int i = 0; i < PROFILE_BINS; i++) {
+    update(bins.up[i], day.up[i], isFirst);
+    update(bins.dn[i], day.dn[i], isFirst);
+    if (day.speed[i] > 0) update(bins.speed[i], day.speed[i], bins.speed[i].mean == 0);
+  }
+  bins.nDays++;
+  prof.lastDay = startOfDay;
+}
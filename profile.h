@@ -0,0 +1,57 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <time.h>
+
+//
+// Typical traffic for each day of the week, in 15mins intervals.
+//
+// Each interval keeps an exponentially weighted mean and variance of the
+// number of cars in each direction and of their average speed, so adding a
+// day only updates that day's intervals. Intervals of a new day that are too
+// far from the mean are reported before the day is added to the profile.
+//
+
+#define PROFILE_BINS (24 * 4)
+
+typedef struct profileDay_s {
+  unsigned int up[PROFILE_BINS];
+  unsigned int dn[PROFILE_BINS];
+  // Average speed, or 0 if there are no valid speeds in the interval
+  double       speed[PROFILE_BINS];
+} profileDay_t;
+
+
+//
+// Load the profiles. A missing file is the same as empty profiles.
+//
+bool profileLoad(const char *fname);
+
+bool profileSave(const char *fname);
+
+//
+// Report the intervals of a day more than 'zMax' standard deviations away
+// from the profile for that day of the week, then add the day to the profile.
+// A day older than the last one added for that day of the week is not added.
+// The last one added is replaced instead, so the complete log of a day
+// supersedes a partial one analyzed before the day was over.
+//
+void profileDay(unsigned int wday, time_t startOfDay, const profileDay_t &day, double zMax);
+
+#endif
@@ -0,0 +1,180 @@
+#! /bin/bash
+
+#
+# Replay a corpus of raw captures and daily logs through the CarCounter and
+# the Analyzer, compare their output against the golden files and record
+# how long each run took and how much memory it used.
+#
+# Usage: regress.sh [-u] [-n n] [-o fname]
+#
+#    -u         Update the golden files instead of comparing against them
+#    -n n       Run each case n times, keeping the fastest (default: 1)
+#    -o fname   Results file (default: regress.d/results.tsv)
+#
+# The corpus is synthesized by the Generator, so it is the same on every run.
+#
+
+ROOT=`cd \`dirname $0\`; pwd`
+GOLDEN="$ROOT/golden"
+WORK="$ROOT/regress.d"
+
+UPDATE=0
+NRUNS=1
+RESULTS="$WORK/results.tsv"
+
+while getopts "un:o:" opt; do
+    case $opt in
+	u) UPDATE=1 ;;
+	n) NRUNS=$OPTARG ;;
+	o) RESULTS=`cd \`dirname $OPTARG\`; pwd`/`basename $OPTARG` ;;
+	*) exit 1 ;;
+    esac
+done
+
+# Dates in the reports depend on the time zone
+export TZ=UTC
+
+mkdir -p "$WORK/logs/2018-03" "$GOLDEN"
+cd "$WORK"
+
+BUILD=${BUILD:-`git -C "$ROOT" describe --always --dirty 2>/dev/null || echo unknown`}
+if [ ! -f "$RESULTS" ]; then
+    printf "build\tcase\twall_s\titems\titems_per_s\tmaxrss_kb\tresult\n" > "$RESULTS"
+fi
+
+FAILED=0
+
+
+#
+# Generate an input, unless it is already up to date
+#
+generate() {
+    local fname=$1
+    shift
+    if [ ! -f "$fname" -o "$ROOT/Generator" -nt "$fname" ]; then
+	"$ROOT/Generator" "$@" -o "$fname" || exit 1
+    fi
+}
+
+
+#
+# Run a case and compare its output with the golden file(s)
+#   [STATUS=n] [SAME_AS=case] runCase name nItems cmd [args...]
+# The output is the standard output and error of the command, plus name.svg if it creates one.
+# The command must exit with STATUS (default: 0). SAME_AS compares with the
+# golden files of another case instead.
+#
+runCase() {
+    local name=$1
+    local items=$2
+    shift 2
+    local status=${STATUS:-0}
+    local golden=${SAME_AS:-$name}
+
+    rm -f "$name.svg"
+    local best=""
+    local rss=""
+    for ((i = 0; i < NRUNS; i++)); do
+	"$ROOT/Runstat" -o "$name.stat" "$@" > "$name.out" 2>&1
+	read wall maxrss code < "$name.stat"
+	if [ "$code" != "$status" ]; then
+	    echo "FAIL $name: exit status $code"
+	    FAILED=1
+	    break
+	fi
+	if [ -z "$best" ] || awk "BEGIN {exit !($wall < $best)}"; then
+	    best=$wall
+	    rss=$maxrss
+	fi
+    done
+
+    local result="pass"
+    if [ $UPDATE -eq 1 -a "$golden" = "$name" ]; then
+	cp "$name.out" "$GOLDEN/$name.out"
+	if [ -f "$name.svg" ]; then cp "$name.svg" "$GOLDEN/$name.svg"; fi
+	result="updated"
+    else
+	for ext in out svg; do
+	    if [ ! -f "$name.$ext" -a ! -f "$GOLDEN/$golden.$ext" ]; then continue; fi
+	    if ! diff -q "$GOLDEN/$golden.$ext" "$name.$ext" > /dev/null 2>&1; then
+		result="FAIL"
+		FAILED=1
+		diff "$GOLDEN/$golden.$ext" "$name.$ext" | head -10
+	    fi
+	done
+    fi
+
+    local rate=`awk "BEGIN {printf \"%.0f\", ($best > 0) ? $items / $best : 0}"`
+    printf "%-4s %-14s %8s s %10s items/s %8s KB\n" $result $name $best $rate $rss
+    printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$BUILD" $name $best $items $rate $rss $result >> "$RESULTS"
+}
+
+
+#
+# Raw captures through the CarCounter, in replay mode
+#
+generate light.raw  -s 11 -t 600 -v 120
+generate trucks.raw -s 12 -t 600 -v 400 -k 0.3
+generate noisy.raw  -s 13 -t 600 -v 120 -n 20 -d 96 -b 0.001
+# Must recover from the stuck hose
+generate stuck.raw  -s 14 -t 600 -v 120 -j 60
+
+for raw in light trucks noisy stuck; do
+    runCase cc-$raw `wc -l < $raw.raw` "$ROOT/CarCounter" -r $raw.raw
+done
+rm -f CarCount.pid
+
+
+#
+# A week of daily logs through the Analyzer. Some vehicles are logged twice
+# or late, for the Analyzer to merge, put back in order or drop.
+#
+LOGS=""
+for day in 04 05 06 07 08 09 10; do
+    log=logs/2018-03/2018-03-$day
+    generate $log -L -s $day -T `date -d 2018-03-$day +%s` -t 86400 -v 40 -x 0.05
+    LOGS="$LOGS $log"
+done
+NEVENTS=`cat $LOGS | wc -l`
+
+runCase an-count $NEVENTS "$ROOT/Analyzer" -D 1 $LOGS
+runCase an-speed $NEVENTS "$ROOT/Analyzer" -S $LOGS
+runCase an-plot  $NEVENTS "$ROOT/Analyzer" -I an-plot.svg $LOGS
+runCase an-daily $NEVENTS "$ROOT/Analyzer" -d -S -I an-daily.svg $LOGS
+
+# The same logs, compressed
+GZ_LOGS=""
+ZST_LOGS=""
+for log in $LOGS; do
+    if [ ! -f $log.gz -o $log -nt $log.gz ]; then gzip -c $log > $log.gz; fi
+    if [ ! -f $log.zst -o $log -nt $log.zst ]; then zstd -qf $log -o $log.zst || exit 1; fi
+    GZ_LOGS="$GZ_LOGS $log.gz"
+    ZST_LOGS="$ZST_LOGS $log.zst"
+done
+head -c 4000 logs/2018-03/2018-03-04.gz > logs/2018-03/truncated.gz
+
+SAME_AS=an-count runCase an-gz  $NEVENTS "$ROOT/Analyzer" -D 1 $GZ_LOGS
+SAME_AS=an-count runCase an-zst $NEVENTS "$ROOT/Analyzer" -D 1 $ZST_LOGS
+STATUS=255 runCase an-truncated 0 "$ROOT/Analyzer" logs/2018-03/truncated.gz
+
+
+#
+# Day-of-week profiles, over the three weeks before as well. The second run
+# over the same logs must leave the profile as it was.
+#
+mkdir -p logs/2018-02
+PROFILE_LOGS=""
+for ((i = 21; i > 0; i--)); do
+    date=`date -d "2018-03-04 -$i days" +%Y-%m-%d`
+    log=logs/${date:0:7}/$date
+    generate $log -L -s $((100 + i)) -T `date -d $date +%s` -t 86400 -v 40
+    PROFILE_LOGS="$PROFILE_LOGS $log"
+done
+PROFILE_LOGS="$PROFILE_LOGS $LOGS"
+NPROFILE=`cat $PROFILE_LOGS | wc -l`
+
+runCase an-profile   $NPROFILE bash -c "rm -f an-profile.prof; \"$ROOT/Analyzer\" -p an-profile.prof $PROFILE_LOGS"
+runCase an-reprofile $NPROFILE bash -c "cp an-profile.prof again.prof; \"$ROOT/Analyzer\" -p again.prof $PROFILE_LOGS && cmp an-profile.prof again.prof"
+
+echo "Results in $RESULTS"
+exit $FAILED
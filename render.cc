@@ -0,0 +1,249 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+
+
+//
+// Same geometry and colors as the gnuplot output
+//
+#define WIDTH        1000
+#define PANEL_HEIGHT  200
+#define DAILY_HEIGHT  400
+#define LEFT           50
+#define RIGHT          10
+#define TOP            20
+#define BOTTOM         20
+
+#define UP_COLOR "#009e73"
+#define DN_COLOR "#56b4e9"
+
+
+static FILE         *gFp      = NULL;
+static bool          gIsSpeed = false;
+static bool          gIsDaily = false;
+static unsigned int  gPanels  = 0;
+static unsigned int  gNPlots  = 0;
+
+// Accumulated days in daily mode
+static renderBin_t  *gDays    = NULL;
+static char        (*gDates)[16] = NULL;
+static unsigned int  gNDays   = 0;
+
+
+typedef struct axis_s {
+  double       min;
+  double       max;
+  const int   *ticks;
+  unsigned int nTicks;
+} axis_t;
+
+static const int countTicks[] = {-20, 0, 20, 40, 60};
+static const int dailyTicks[] = {-200, -150, -100, -50, 0, 50, 100, 150, 200, 250, 300, 350, 400};
+static const int speedTicks[] = {0, 5, 10, 15, 20, 25, 30};
+
+static const axis_t countAxis = {-20,  80, countTicks, sizeof(countTicks)/sizeof(int)};
+static const axis_t dailyAxis = {-200, 400, dailyTicks, sizeof(dailyTicks)/sizeof(int)};
+static const axis_t speedAxis = {0,    30, speedTicks, sizeof(speedTicks)/sizeof(int)};
+
+
+//
+// Map a value onto the vertical pixel coordinate of a panel, clipping to the axis range
+//
+static double
+yPos(const axis_t &axis, double val, unsigned int height)
+{
+  if (val < axis.min) val = axis.min;
+  if (val > axis.max) val = axis.max;
+  double span = height - TOP - BOTTOM;
+  return TOP + span * (axis.max - val) / (axis.max - axis.min);
+}
+
+
+//
+// Draw one panel. 'labels' is an array of 16-char strings, one per bin,
+// of which only every 'labelEvery'th is printed.
+//
+static void
+renderPanel(unsigned int y0, unsigned int height, const char *title,
+	    const renderBin_t *bins, unsigned int nBins,
+	    const char (*labels)[16], unsigned int labelEvery,
+	    const axis_t &axis, const char *upTitle, const char *dnTitle)
+{
+  double bw = (double) (WIDTH - LEFT - RIGHT) / nBins;
+
+  fprintf(gFp, "<g transform=\"translate(0,%u)\">\n", y0);
+  fprintf(gFp, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">%s</text>\n", WIDTH/2, TOP - 5, title);
+
+  // Y axis ticks and grid
+  for (unsigned int i = 0; i < axis.nTicks; i++) {
+    double y = yPos(axis, axis.ticks[i], height);
+    fprintf(gFp, "<line x1=\"%d\" y1=\"%.1f\" x2=\"%d\" y2=\"%.1f\" stroke=\"#ddd\"/>"
+	    "<text x=\"%d\" y=\"%.1f\" text-anchor=\"end\">%d</text>\n",
+	    LEFT, y, WIDTH - RIGHT, y, LEFT - 4, y + 4, axis.ticks[i]);
+  }
+  fprintf(gFp, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"none\" stroke=\"black\"/>\n",
+	  LEFT, TOP, WIDTH - LEFT - RIGHT, height - TOP - BOTTOM);
+
+  for (unsigned int i = 0; i < nBins; i++) {
+    double x = LEFT + i * bw;
+
+    if (labels != NULL && i % labelEvery == 0) {
+      fprintf(gFp, "<text x=\"%.1f\" y=\"%d\" text-anchor=\"middle\">%s</text>\n",
+	      x + bw/2, height - 6, labels[i]);
+    }
+
+    if (gIsSpeed) {
+      // Whisker from min to max with a marker at the average
+      if (bins[i].up > 0) {
+	fprintf(gFp, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\" stroke=\"%s\" stroke-width=\"3\"/>"
+		"<rect x=\"%.1f\" y=\"%.1f\" width=\"6\" height=\"6\" fill=\"%s\"/>\n",
+		x + bw/2, yPos(axis, bins[i].upMin, height), x + bw/2, yPos(axis, bins[i].upMax, height), UP_COLOR,
+		x + bw/2 - 3, yPos(axis, bins[i].upAve, height) - 3, UP_COLOR);
+      }
+      if (bins[i].dn > 0) {
+	fprintf(gFp, "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\" stroke=\"%s\" stroke-width=\"3\"/>"
+		"<rect x=\"%.1f\" y=\"%.1f\" width=\"6\" height=\"6\" fill=\"%s\"/>\n",
+		x + bw/2, yPos(axis, bins[i].dnMin, height), x + bw/2, yPos(axis, bins[i].dnMax, height), DN_COLOR,
+		x + bw/2 - 3, yPos(axis, bins[i].dnAve, height) - 3, DN_COLOR);
+      }
+    } else {
+      // Uphill stacked above 0, downhill below
+      double y0 = yPos(axis, 0, height);
+      double yu = yPos(axis, bins[i].up, height);
+      double yd = yPos(axis, -(double) bins[i].dn, height);
+      if (bins[i].up > 0) {
+	fprintf(gFp, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\" fill=\"%s\" stroke=\"black\"/>\n",
+		x, yu, bw, y0 - yu, UP_COLOR);
+      }
+      if (bins[i].dn > 0) {
+	fprintf(gFp, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\" fill=\"%s\" stroke=\"black\"/>\n",
+		x, y0, bw, yd - y0, DN_COLOR);
+      }
+    }
+  }
+
+  // Key
+  fprintf(gFp, "<text x=\"%d\" y=\"%d\" text-anchor=\"end\" fill=\"%s\">%s</text>\n",
+	  WIDTH - RIGHT - 5, height/2 - 8, UP_COLOR, upTitle);
+  fprintf(gFp, "<text x=\"%d\" y=\"%d\" text-anchor=\"end\" fill=\"%s\">%s</text>\n",
+	  WIDTH - RIGHT - 5, height/2 + 8, DN_COLOR, dnTitle);
+  fprintf(gFp, "</g>\n");
+}
+
+
+bool
+renderOpen(const char *fname, unsigned int nPlots, bool isSpeed, bool isDaily)
+{
+  gFp = fopen(fname, "w");
+  if (gFp == NULL) {
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for writing: %s\n", fname, strerror(errno));
+    return false;
+  }
+
+  gIsSpeed = isSpeed;
+  gIsDaily = isDaily;
+  gNPlots  = nPlots;
+  gPanels  = 0;
+  gNDays   = 0;
+
+  unsigned int height = (isDaily) ? DAILY_HEIGHT : nPlots * PANEL_HEIGHT;
+  fprintf(gFp, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%u\" "
+	  "font-family=\"sans-serif\" font-size=\"10\">\n", WIDTH, height);
+  fprintf(gFp, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+
+  if (isDaily) {
+    gDays  = (renderBin_t *) malloc(nPlots * sizeof(renderBin_t));
+    gDates = (char (*)[16]) malloc(nPlots * sizeof(*gDates));
+    if (gDays == NULL || gDates == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory for %d days\n", nPlots);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void
+renderDay(const char *date, const char *wday,
+	  const renderBin_t *bins, unsigned int nBins,
+	  const renderBin_t &total)
+{
+  if (gFp == NULL) return;
+
+  if (gIsDaily) {
+    if (gNDays >= gNPlots) return;
+    gDays[gNDays] = total;
+    snprintf(gDates[gNDays], sizeof(*gDates), "%s", date);
+    gNDays++;
+    return;
+  }
+
+  if (gPanels >= gNPlots) return;
+
+  char title[64];
+  char upTitle[64];
+  char dnTitle[64];
+  snprintf(title, sizeof(title), "%s %s", wday, date);
+  if (gIsSpeed) {
+    snprintf(upTitle, sizeof(upTitle), "Uphill %.1f/%.1f MPH Ave/Max Speed", total.upAve, total.upMax);
+    snprintf(dnTitle, sizeof(dnTitle), "Downhill %.1f/%.1f MPH Ave/Max Speed", total.dnAve, total.dnMax);
+  } else {
+    snprintf(upTitle, sizeof(upTitle), "%d   Uphill", total.up);
+    snprintf(dnTitle, sizeof(dnTitle), "%d Downhill", total.dn);
+  }
+
+  // Hourly labels, starting at 06:00
+  char labels[24*4][16];
+  if (nBins > 24*4) nBins = 24*4;
+  for (unsigned int i = 0; i < nBins; i++) {
+    snprintf(labels[i], sizeof(labels[i]), "%02d:%02d", 6 + (i/4), 15 * (i % 4));
+  }
+
+  renderPanel(gPanels * PANEL_HEIGHT, PANEL_HEIGHT, title, bins, nBins, labels, 4,
+	      (gIsSpeed) ? speedAxis : countAxis, upTitle, dnTitle);
+  gPanels++;
+
+  // Panels are streamed out as they are produced so memory stays bounded
+  fflush(gFp);
+}
+
+
+void
+renderClose()
+{
+  if (gFp == NULL) return;
+
+  if (gIsDaily && gNDays > 0) {
+    renderPanel(0, DAILY_HEIGHT, "", gDays, gNDays, gDates, 7,
+		(gIsSpeed) ? speedAxis : dailyAxis, "Uphill", "Downhill");
+  }
+
+  fprintf(gFp, "</svg>\n");
+  fclose(gFp);
+  gFp = NULL;
+
+  free(gDays);
+  free(gDates);
+  gDays  = NULL;
+  gDates = NULL;
+}
@@ -0,0 +1,50 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __RENDER_H__
+#define __RENDER_H__
+
+//
+// In-process rendering of the Analyzer plots as SVG, for plot sets that
+// are too large to push through gnuplot.
+//
+
+typedef struct renderBin_s {
+  unsigned int up;
+  unsigned int dn;
+  // Speeds are only meaningful if the corresponding count is not zero
+  double upMin, upAve, upMax;
+  double dnMin, dnAve, dnMax;
+} renderBin_t;
+
+
+//
+// Open the image file. 'nPlots' is the number of days that may be plotted.
+//
+bool renderOpen(const char *fname, unsigned int nPlots, bool isSpeed, bool isDaily);
+
+//
+// Render one day. In 15mins-interval mode, 'bins' covers 06:00 to 22:00 and
+// the day is drawn immediately in its own panel. In daily mode, only 'total'
+// is used and is accumulated until renderClose().
+//
+void renderDay(const char *date, const char *wday,
+	       const renderBin_t *bins, unsigned int nBins,
+	       const renderBin_t &total);
+
+void renderClose();
+
+#endif
@@ -0,0 +1,203 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rt.h"
+
+
+// Stack that is faulted in ahead of time
+#define PREFAULT_STACK (256 * 1024)
+
+// Periods are histogrammed with a 1us resolution, up to that many us
+#define JITTER_MAX_US  100000
+
+static char     gStdoutBuf[BUFSIZ];
+static uint32_t gJitter[JITTER_MAX_US + 1];
+
+// Sampling period, and when the next one starts (ns)
+static uint64_t gPeriodNs = 0;
+static uint64_t gNextNs   = 0;
+
+
+static uint64_t
+monotonicNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+//
+// Warn if an unpaced loop will be throttled by the kernel
+//
+static void
+checkThrottling()
+{
+  long runtime = -1;
+  long period  = 0;
+  FILE *fp = fopen("/proc/sys/kernel/sched_rt_runtime_us", "r");
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld", &runtime) != 1) runtime = -1;
+    fclose(fp);
+  }
+  fp = fopen("/proc/sys/kernel/sched_rt_period_us", "r");
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld", &period) != 1) period = 0;
+    fclose(fp);
+  }
+  if (runtime < 0 || runtime >= period) return;
+
+  fprintf(stderr, "WARNING: Real-time tasks are throttled to %ld us every %ld us (kernel.sched_rt_runtime_us):\n"
+	  "         sampling as fast as possible will stop for %ld ms every %ld ms\n",
+	  runtime, period, (period - runtime) / 1000, period / 1000);
+}
+
+
+static void
+prefaultStack()
+{
+  volatile char stack[PREFAULT_STACK];
+  for (unsigned int i = 0; i < PREFAULT_STACK; i += 4096) stack[i] = 0;
+  (void) stack[0];
+}
+
+
+bool
+rtEnable(const rtConfig_t &cfg)
+{
+  if (cfg.periodUs == 0) checkThrottling();
+
+  // stdout and the time zone allocate memory the first time they are used
+  fflush(stdout);
+  setvbuf(stdout, gStdoutBuf, _IOFBF, sizeof(gStdoutBuf));
+  tzset();
+  time_t now = time(NULL);
+  struct tm tm;
+  localtime_r(&now, &tm);
+
+  // Freed memory must stay mapped, and not come back as new pages
+  mallopt(M_TRIM_THRESHOLD, -1);
+  mallopt(M_MMAP_MAX, 0);
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    fprintf(stderr, "ERROR: Cannot lock memory: %s\n", strerror(errno));
+    return false;
+  }
+  prefaultStack();
+
+  int cpu = cfg.cpu;
+  if (cpu < 0) cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+    fprintf(stderr, "ERROR: Cannot run on CPU %d: %s\n", cpu, strerror(errno));
+    return false;
+  }
+
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = cfg.priority;
+  if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+    fprintf(stderr, "ERROR: Cannot set SCHED_FIFO priority %d: %s\n", cfg.priority, strerror(errno));
+    return false;
+  }
+
+  gPeriodNs = cfg.periodUs * 1000ULL;
+  gNextNs   = monotonicNs();
+
+  return true;
+}
+
+
+void
+rtPace()
+{
+  if (gPeriodNs == 0) return;
+
+  gNextNs += gPeriodNs;
+  uint64_t now = monotonicNs();
+  if (now >= gNextNs + gPeriodNs) {
+    gNextNs = now;
+    return;
+  }
+
+  struct timespec next;
+  next.tv_sec  = gNextNs / 1000000000ULL;
+  next.tv_nsec = gNextNs % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+}
+
+
+static uint32_t
+percentile(unsigned int nSamples, double pct)
+{
+  uint64_t target = (uint64_t) (nSamples * pct / 100.0);
+  uint64_t count  = 0;
+  for (uint32_t us = 0; us <= JITTER_MAX_US; us++) {
+    count += gJitter[us];
+    if (count > target) return us;
+  }
+  return JITTER_MAX_US;
+}
+
+
+void
+rtJitter(const char *label, unsigned int nSamples, void (*sample)(), bool isPaced)
+{
+  memset(gJitter, 0, sizeof(gJitter));
+
+  struct timespec prev;
+  struct timespec now;
+  uint64_t max = 0;
+
+  sample();
+  clock_gettime(CLOCK_MONOTONIC, &prev);
+  for (unsigned int i = 0; i < nSamples; i++) {
+    if (isPaced) rtPace();
+    sample();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t us = (now.tv_sec - prev.tv_sec) * 1000000 + (now.tv_nsec - prev.tv_nsec) / 1000;
+    if (us > max) max = us;
+    gJitter[(us < JITTER_MAX_US) ? us : JITTER_MAX_US]++;
+    prev = now;
+  }
+
+  printf("%s: %u samples, period min %u us, median %u us, 99%% %u us, 99.9%% %u us, max %llu us\n",
+	 label, nSamples, percentile(nSamples, 0), percentile(nSamples, 50),
+	 percentile(nSamples, 99), percentile(nSamples, 99.9), (unsigned long long) max);
+
+  // Coarse distribution, in power-of-two buckets
+  uint32_t lo = 0;
+  for (uint32_t hi = 1; lo <= JITTER_MAX_US; hi *= 2) {
+    uint64_t count = 0;
+    for (uint32_t us = lo; us < hi && us <= JITTER_MAX_US; us++) count += gJitter[us];
+    if (count > 0) printf("    [%6u, %6u) us: %8llu\n", lo, hi, (unsigned long long) count);
+    lo = hi;
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,51 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef __RT_H__
+#define __RT_H__
+
+//
+// Real-time mode for the sampler: SCHED_FIFO priority, pinned to a CPU, and
+// all memory locked and faulted in so that sampling never waits for a page.
+//
+// Everything the sampling loop needs must be allocated before rtEnable().
+// It also sets up stdout and the time zone so that printing a vehicle does
+// not allocate memory later on.
+//
+
+typedef struct rtConfig_s {
+  int          priority;   // SCHED_FIFO priority
+  int          cpu;        // CPU to run on, or -1 for the last one
+  unsigned int periodUs;   // Sampling period, or 0 to sample as fast as possible
+} rtConfig_t;
+
+
+bool rtEnable(const rtConfig_t &cfg);
+
+//
+// Sleep until the next sampling period. A SCHED_FIFO loop that never sleeps
+// is throttled by the kernel, and starves everything else on its CPU.
+// Periods that are missed altogether are skipped, not made up.
+//
+void rtPace();
+
+//
+// Measure the period of 'nSamples' calls to 'sample' and report its distribution,
+// pacing the calls with rtPace() if 'isPaced'
+//
+void rtJitter(const char *label, unsigned int nSamples, void (*sample)(), bool isPaced = false);
+
+#endif
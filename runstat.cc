@@ -0,0 +1,99 @@
+//
+// Copyright 2018 Janick Bergeron <janick@bergeron.com>
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+//
+// Run a command and report its wall time and peak memory usage,
+// for the regression harness.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+void
+usage(const char* cmd)
+{
+  fprintf(stderr, "Usage: %s -o fname cmd [args...]\n", cmd);
+  fprintf(stderr, "\nWrites \"<wall secs> <peak RSS KB> <exit status>\" in fname\n");
+  exit(-1);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  const char *fname = NULL;
+
+  int optc;
+  while ((optc = getopt(argc, argv, "+ho:")) != -1) {
+    switch (optc) {
+    case 'o':
+      fname = optarg;
+      break;
+
+    case 'h':
+    case '?':
+      usage(argv[0]);
+    }
+  }
+
+  if (fname == NULL || optind == argc) usage(argv[0]);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "ERROR: Cannot fork: %s\n", strerror(errno));
+    return -1;
+  }
+  if (pid == 0) {
+    execvp(argv[optind], argv + optind);
+    fprintf(stderr, "ERROR: Cannot run \"%s\": %s\n", argv[optind], strerror(errno));
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    fprintf(stderr, "ERROR: Cannot wait for \"%s\": %s\n", argv[optind], strerror(errno));
+    return -1;
+  }
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  int code = (WIFEXITED(status)) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+  FILE *fp = fopen(fname, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "ERROR: Cannot open \"%s\" for writing: %s\n", fname, strerror(errno));
+    return -1;
+  }
+  fprintf(fp, "%.3f %ld %d\n", wall, usage.ru_maxrss, code);
+  fclose(fp);
+
+  return code;
+}
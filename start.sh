@@ -7,7 +7,14 @@ cd $ROOT
 # Kill any running instance
 #
 if [ -f CarCount.pid ]; then
-    kill -9 `cat CarCount.pid`
+    PID=`cat CarCount.pid`
+    # Let it write out the samples it has buffered, but don't wait forever
+    kill -TERM $PID
+    for i in `seq 30`; do
+	kill -0 $PID 2> /dev/null || break
+	sleep 1
+    done
+    kill -9 $PID 2> /dev/null
     rm -f CarCount.pid
 fi
 
@@ -5,4 +5,15 @@ ROOT='/home/CarCounter'
 #
 # Kill any running instance
 #
-kill -9 `cat $ROOT/CarCount.pid`
+cd $ROOT
+
+if [ -f CarCount.pid ]; then
+    PID=`cat CarCount.pid`
+    # Let it write out the samples it has buffered, but don't wait forever
+    kill -TERM $PID
+    for i in `seq 30`; do
+	kill -0 $PID 2> /dev/null || break
+	sleep 1
+    done
+    kill -9 $PID 2> /dev/null
+fi